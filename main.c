@@ -1,13 +1,24 @@
+//Needed for memmem(), O_CLOEXEC, tee() and splice()
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <ctype.h>
 
 //Maximum characters allowed to be input
 #define MAX_CHARS_INPUT 2048
@@ -18,9 +29,256 @@
 //Was not sure if PID could extend beyond 14 digits
 #define MAX_PID_LENGTH 14
 
+//History file created in the HOME directory
+#define HISTORY_FILE_NAME ".smallsh_history"
+//Environment variable that overrides the history file location
+#define HISTORY_FILE_ENV "SMALLSH_HISTFILE"
+//Initial number of slots in the history line hash table (power of two)
+#define HISTORY_HASH_INIT 1024
+//Number of bits used to hash a trigram into the n-gram index
+#define HISTORY_NGRAM_BITS 16
+#define HISTORY_NGRAM_BUCKETS (1 << HISTORY_NGRAM_BITS)
+//Status recorded for history entries whose status is not known
+#define HISTORY_STATUS_UNKNOWN -1
+
+//Time a timed out job gets to exit after SIGTERM before it is sent SIGKILL
+#define DEADLINE_GRACE_MS 5000
+
+//Pipe size requested when output is copied to several files with tee/splice
+#define FAN_OUT_PIPE_SIZE (1024 * 1024)
+//Buffer used when an output file does not accept splice
+#define FAN_OUT_BUFFER 65536
+
+//CPU time reported by wait4 may be this much below an RLIMIT_CPU that was hit
+#define CPU_LIMIT_SLACK_MS 50
+
+//Maximum nesting of for / while loops
+#define MAX_LOOP_DEPTH 32
+//Maximum length of a loop read over several lines, it has to fit
+//in one history line (inputLine) so that !n replays the whole loop
+#define MAX_LOOP_CHARS MAX_CHARS_INPUT
+
+//Results of execute_command that are not a wait status
+#define EXEC_NOTHING -1
+#define EXEC_BACKGROUND -2
+#define EXEC_FORK_FAILED -3
+
 // Global foreground mode indicator variable
 bool foreground_only_mode = false;
 
+// Self-pipe written by the SIGCHLD handler so that poll() wakes up when a child exits
+int sigchld_pipe[2] = { -1, -1 };
+
+// Command started by a fan-out process, target of forwarded SIGTERM
+pid_t fan_out_command_pid = 0;
+
+// Set in the copy of the shell that runs a loop in the background
+bool in_background_loop = false;
+
+// Pid of the interactive shell, what $$ expands to (also in background loops)
+pid_t shell_pid = 0;
+
+/*
+ * struct:  _histLine, HistLine
+ * --------------------------------------------------------------------------
+ * One distinct command line in the history. Repeated commands share a single
+ * HistLine, so the hash table and n-gram index only cover each text once.
+ *
+ * Struct Members:
+ *  const char* text: command text, points into the mmap'd history file or
+ *      into a heap copy for commands entered during this session. Not null terminated.
+ *  int len: length of text
+ *  unsigned int hash: FNV-1a hash of text
+ *  int lastEntry: most recent entry number of this line, used by !prefix
+ *  bool owned: true if text is a heap copy that must be freed
+ */
+typedef struct _histLine {
+    const char* text;
+    int len;
+    unsigned int hash;
+    int lastEntry;
+    bool owned;
+}HistLine;
+
+/*
+ * struct:  _histEntry, HistEntry
+ * --------------------------------------------------------------------------
+ * One executed command in the history, numbered in the order it was run.
+ *
+ * Struct Members:
+ *  int lineId: index of the command text in History lines
+ *  int status: wait status of the command, HISTORY_STATUS_UNKNOWN if not recorded
+ *  long duration_ms: wall clock run time of the command in milliseconds
+ */
+typedef struct _histEntry {
+    int lineId;
+    int status;
+    long duration_ms;
+}HistEntry;
+
+/*
+ * struct:  _histPostings, HistPostings
+ * --------------------------------------------------------------------------
+ * Ascending list of line ids containing a trigram that hashes to one bucket
+ * of the n-gram index.
+ */
+typedef struct _histPostings {
+    int* ids;
+    int count;
+    int capacity;
+}HistPostings;
+
+/*
+ * struct:  _history, History
+ * --------------------------------------------------------------------------
+ * Persistent command history. The history file is append-only and shared by
+ * every running smallsh; each record is added with a single write() on an
+ * O_APPEND descriptor so records from concurrent shells never interleave.
+ * Records present at startup are read through an mmap of the file.
+ *
+ * Record format (one per line):
+ *  ": <wait status>:<duration ms>;<command>"
+ *
+ * Struct Members:
+ *  int fd: history file descriptor, -1 if history is not persisted
+ *  char* map, size_t mapLen: read-only mapping of the file taken at startup
+ *  HistLine* lines: distinct command lines, lineCount used of lineCapacity
+ *  int* table: open addressing hash table of line id + 1 (0 = empty slot)
+ *  HistEntry* entries: executed commands in order, entryCount used of entryCapacity
+ *  HistPostings* ngrams: trigram index over lines, HISTORY_NGRAM_BUCKETS lists
+ */
+typedef struct _history {
+    int fd;
+    char* map;
+    size_t mapLen;
+    HistLine* lines;
+    int lineCount;
+    int lineCapacity;
+    int* table;
+    int tableCapacity;
+    HistEntry* entries;
+    int entryCount;
+    int entryCapacity;
+    HistPostings* ngrams;
+}History;
+
+/*
+ * struct:  _deadline, Deadline
+ * --------------------------------------------------------------------------
+ * Entry of the deadline min-heap. The heap is ordered by when, and the
+ * timerfd is always armed for the earliest deadline.
+ *
+ * Struct Members:
+ *  struct timespec when: CLOCK_MONOTONIC time of the next action
+ *  pid_t pid: process the deadline applies to
+ *  long grace_ms: time between SIGTERM and SIGKILL
+ *  int stage: DEADLINE_TERM (SIGTERM due), DEADLINE_KILL (SIGKILL due) or
+ *      DEADLINE_DONE (SIGKILL sent, kept until the process is reaped)
+ */
+typedef struct _deadline {
+    struct timespec when;
+    pid_t pid;
+    long grace_ms;
+    int stage;
+}Deadline;
+
+enum { DEADLINE_TERM, DEADLINE_KILL, DEADLINE_DONE };
+
+/*
+ * struct:  _procSample, ProcSample
+ * --------------------------------------------------------------------------
+ * Open /proc descriptors of a process sampled by jobstat, kept between
+ * samples so that each refresh is a pread() instead of open/read/close.
+ *
+ * Struct Members:
+ *  pid_t pid: sampled process
+ *  int statFd, statmFd, childrenFd: /proc/<pid>/stat, statm and
+ *      task/<pid>/children (-1 if not cached, read with open/read/close)
+ *  unsigned long long cpuTicks: utime + stime at the previous sample
+ *  double sampledAt: CLOCK_BOOTTIME seconds of the previous sample, 0 if none
+ *  bool seen: process was found during the current sample
+ */
+typedef struct _procSample {
+    pid_t pid;
+    int statFd;
+    int statmFd;
+    int childrenFd;
+    unsigned long long cpuTicks;
+    double sampledAt;
+    bool seen;
+}ProcSample;
+
+/*
+ * struct:  _nodeList, NodeList / _shellNode, ShellNode
+ * --------------------------------------------------------------------------
+ * Parsed form of a for / while loop. A loop is parsed once and its commands
+ * are run from this structure on every iteration; only words containing "$"
+ * are substituted again.
+ *
+ * NodeList Members:
+ *  ShellNode* nodes: commands in order, count used of capacity
+ *
+ * ShellNode Members:
+ *  int type: NODE_COMMAND, NODE_FOR or NODE_WHILE
+ *  char** words: words of a command, or the word list of a for loop
+ *  bool* expand: true for the words that contain "$"
+ *  int wordCount, wordCapacity: number of words / allocated words
+ *  char* name: variable of a for loop
+ *  NodeList condition: condition of a while loop
+ *  NodeList body: body of a for / while loop
+ *  bool background: loop followed by "&"
+ */
+typedef struct _shellNode ShellNode;
+
+typedef struct _nodeList {
+    ShellNode* nodes;
+    int count;
+    int capacity;
+}NodeList;
+
+struct _shellNode {
+    int type;
+    char** words;
+    bool* expand;
+    int wordCount;
+    int wordCapacity;
+    char* name;
+    NodeList condition;
+    NodeList body;
+    bool background;
+};
+
+enum { NODE_COMMAND, NODE_FOR, NODE_WHILE };
+enum { PARSE_OK, PARSE_INCOMPLETE, PARSE_ERROR };
+
+/*
+ * struct:  _limitOption, LimitOption / _limits, Limits
+ * --------------------------------------------------------------------------
+ * Resource limits applied to commands right before exec. limit_options maps
+ * the ulimit / limit options to their rlimit resource. Limits holds one
+ * value per entry of limit_options; limits that are not set are inherited
+ * from the shell.
+ */
+typedef struct _limitOption {
+    char option;
+    int resource;
+    const char* name;
+}LimitOption;
+
+enum { LIMIT_AS, LIMIT_CPU, LIMIT_NPROC, LIMIT_NOFILE, LIMIT_COUNT };
+
+const LimitOption limit_options[LIMIT_COUNT] = {
+    { 'v', RLIMIT_AS, "address space" },
+    { 't', RLIMIT_CPU, "cpu seconds" },
+    { 'u', RLIMIT_NPROC, "processes" },
+    { 'n', RLIMIT_NOFILE, "open files" }
+};
+
+typedef struct _limits {
+    bool set[LIMIT_COUNT];
+    rlim_t value[LIMIT_COUNT];
+}Limits;
+
 
 /*
  * struct:  _commands, Commands
@@ -41,6 +299,28 @@ bool foreground_only_mode = false;
  *  int bg_procs_count: total number of background processes stored
  *  char* inputArgs[MAX_ARGS]: tokenized arguments entered by user
  *  int processStatus: child process status.
+ *  struct rusage processUsage: resource usage of the process in processStatus
+ *  char inputLine[MAX_CHARS_INPUT]: command line as entered, used for history
+ *  char* bg_cmdlines[MAX_ARGS]: command lines of background processes
+ *  struct timespec bg_start_times[MAX_ARGS]: start times of background processes
+ *  History history: persistent command history
+ *  long deadline_ms: deadline requested with timeout/--deadline, 0 if none
+ *  long grace_ms: time between SIGTERM and SIGKILL for deadline_ms
+ *  bool timedOut: true if the last foreground process hit its deadline
+ *  Deadline deadlines[MAX_ARGS]: min-heap of pending process deadlines
+ *  int deadline_count: number of entries in the deadlines heap
+ *  int timer_fd: timerfd armed for the earliest deadline
+ *  ProcSample* proc_samples: cached /proc descriptors used by jobstat,
+ *      proc_sample_count used of proc_sample_capacity
+ *  NodeList loop: loop parsed by get_user_input, empty for other commands
+ *  char* loop_text: text of the loop, the words of loop point into it
+ *  char* loop_names[MAX_LOOP_DEPTH], char* loop_values[MAX_LOOP_DEPTH]:
+ *      variables of the running for loops, innermost last
+ *  int loop_depth: number of running for loops
+ *  Limits default_limits: resource limits set with ulimit
+ *  Limits limits: resource limits of the current command
+ *  Limits bg_limits[MAX_ARGS]: resource limits of background processes
+ *  const char* limitExceeded: limit that stopped the last foreground process, NULL if none
  *
  */
 
@@ -59,6 +339,48 @@ typedef struct _commands {
     char* inputArgs[MAX_ARGS];
     //Stores child process status
     int processStatus;
+    //Resource usage of that process, from wait4()
+    struct rusage processUsage;
+    //Command line as entered, before $$ expansion
+    char inputLine[MAX_CHARS_INPUT];
+    //Command lines of background processes, same index as background_processes
+    char* bg_cmdlines[MAX_ARGS];
+    //Start times of background processes, same index as background_processes
+    struct timespec bg_start_times[MAX_ARGS];
+    //Persistent command history
+    History history;
+    //Deadline of the current command in milliseconds, 0 if none
+    long deadline_ms;
+    //Grace period between SIGTERM and SIGKILL for the current command
+    long grace_ms;
+    //Flag set if the last foreground process was killed by its deadline
+    bool timedOut;
+    //Min-heap of process deadlines ordered by expiry time
+    Deadline deadlines[MAX_ARGS];
+    //Number of deadlines in the heap
+    int deadline_count;
+    //timerfd armed for the earliest deadline
+    int timer_fd;
+    //Cached /proc descriptors of processes sampled by jobstat
+    ProcSample* proc_samples;
+    int proc_sample_count;
+    int proc_sample_capacity;
+    //Loop read by get_user_input, parsed once and run by run_list
+    NodeList loop;
+    //Text of the loop, the words of loop point into it
+    char* loop_text;
+    //Variables of the running for loops, innermost last
+    char* loop_names[MAX_LOOP_DEPTH];
+    char* loop_values[MAX_LOOP_DEPTH];
+    int loop_depth;
+    //Resource limits set with ulimit, applied to every command
+    Limits default_limits;
+    //Resource limits of the current command (defaults plus "limit" prefix)
+    Limits limits;
+    //Resource limits of background processes, same index as background_processes
+    Limits bg_limits[MAX_ARGS];
+    //Limit that stopped the last foreground process
+    const char* limitExceeded;
 }Commands;
 
 
@@ -105,6 +427,20 @@ void handler_SIGTSTP(int signo) {
 }
 
 
+/*
+ * Function:  handler_SIGCHLD
+ * --------------------------------------------------------------------------
+ * Writes a byte to sigchld_pipe when a child process changes state so that
+ * the shell's poll() loops wake up (self-pipe trick). Reaping is still done
+ * with waitpid outside of the handler.
+ */
+void handler_SIGCHLD(int signo) {
+    int savedErrno = errno;
+    write(sigchld_pipe[1], "c", 1);
+    errno = savedErrno;
+}
+
+
 /*
  * Function: void kill_background_processes(Commands *cmds)
  * --------------------------------------------------------------------------
@@ -135,6 +471,22 @@ void kill_background_processes(Commands* cmds) {
 }
 
 
+/*
+ * Function: int find_background_process(Commands* cmds, pid_t pid)
+ * --------------------------------------------------------------------------
+ * Returns the index of pid in the background_processes array, -1 if pid is
+ * not a background process.
+ */
+int find_background_process(Commands* cmds, pid_t pid) {
+    for (int i = 0; i < cmds->bg_procs_count; i++) {
+        if (cmds->background_processes[i] == pid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
 /*
 * Function: init_Commands_List(Commands *cmds)
 * --------------------------------------------------------------------
@@ -146,6 +498,11 @@ void kill_background_processes(Commands* cmds) {
 *   3. int bg_procs_count: total count of background processes
 *   4. bool exitStatus: flag to initiate exiting program
 *   5. int processStatus: status of child process
+*   6. char* bg_cmdlines[MAX_ARGS]: command lines of background processes
+*   7. int deadline_count, int timer_fd: empty deadline heap and its timerfd
+*   8. ProcSample* proc_samples: empty jobstat descriptor cache
+*   9. NodeList loop: no loop parsed
+*   10. Limits default_limits, limits: no resource limits
 * 
 */
 
@@ -161,6 +518,31 @@ void init_Commands_List(Commands* cmds) {
     cmds->bg_procs_count = 0;
     //Status of child process monitored by parent process
     cmds->processStatus = 0;
+    memset(&cmds->processUsage, 0, sizeof(struct rusage));
+    //No background command lines saved yet
+    memset(cmds->bg_cmdlines, 0, sizeof(cmds->bg_cmdlines));
+    //No deadlines pending
+    cmds->deadline_ms = 0;
+    cmds->grace_ms = DEADLINE_GRACE_MS;
+    cmds->timedOut = false;
+    cmds->deadline_count = 0;
+    //Timer used to enforce deadlines
+    cmds->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (cmds->timer_fd == -1) {
+        perror("timerfd_create");
+    }
+    //No /proc descriptors cached yet
+    cmds->proc_samples = NULL;
+    cmds->proc_sample_count = 0;
+    cmds->proc_sample_capacity = 0;
+    //No loop parsed
+    memset(&cmds->loop, 0, sizeof(NodeList));
+    cmds->loop_text = NULL;
+    cmds->loop_depth = 0;
+    //No resource limits
+    memset(&cmds->default_limits, 0, sizeof(Limits));
+    cmds->limits = cmds->default_limits;
+    cmds->limitExceeded = NULL;
 }
 
 /*
@@ -283,19 +665,38 @@ void cd_command(Commands* cmds) {
  * were terminated by accessing Commands struct member processStatus. 
  * If so, the exit status or termination signal will be printed to the user
  * Default: if run before any foreground commands, returns a value of 0.
+ * Processes stopped by a timeout/--deadline are reported as "timed out",
+ * processes stopped by a resource limit name the limit.
  * 
  * Parameters:
  *  Commands* cmds: pointer to Commands struct
  *
  * Struct members utilized:
  *  int processStatus: status of child process
+ *  bool timedOut: true if the process was stopped by its deadline
+ *  const char* limitExceeded: resource limit that stopped the process
  * 
  */
 
 //void check_status(int status)
 void check_status(Commands* cmds) {
+    //If the child process was stopped by its deadline
+    if (cmds->timedOut) {
+        if (WIFEXITED(cmds->processStatus)) {
+            printf("timed out: exit value %d\n", WEXITSTATUS(cmds->processStatus));
+        }
+        else {
+            printf("timed out: terminated by signal %d\n", WTERMSIG(cmds->processStatus));
+        }
+        fflush(stdout);
+    }
+    //If the child process was stopped by a resource limit
+    else if (cmds->limitExceeded != NULL) {
+        printf("terminated by signal %d: %s\n", WTERMSIG(cmds->processStatus), cmds->limitExceeded);
+        fflush(stdout);
+    }
     //If the child process terminated normally
-    if (WIFEXITED(cmds->processStatus)) {
+    else if (WIFEXITED(cmds->processStatus)) {
         //Output exit value
         printf("exit value %d \n", WEXITSTATUS(cmds->processStatus));
         fflush(stdout);
@@ -309,179 +710,2106 @@ void check_status(Commands* cmds) {
 }
 
 /*
- * Function:  void expand_variable(char* inputBuffer, int buffLen)
+ * Function:  long elapsed_ms(struct timespec* start)
  * --------------------------------------------------------------------------
- * Called by the function void get_user_input.Takes parameter char* inputBuffer 
- * and replaces pairs of $$ values with the process pid. 
- * Substring comparison is done via char *strstr(const char *main_string, const char *substring).
- * int sprintf(char *str, const char *format, ...) is used for reformatting
- * the string to have pid replace %d.
- *
- * Parameters:
- *  char* inputBuffer: user inputed arguments (untokenized)
- *  int buffLen: Length of the inputBuffer
- *
+ * Returns the number of milliseconds elapsed on the monotonic clock since start.
  */
+long elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
 
-void expand_variable(char* inputBuffer, int buffLen) {
-    //Temporary string buffer used to save inputBuffer char values
-    //and expand $$ values
-    char string[buffLen + 1];
-    strcpy(string, inputBuffer);
-    //Substring to match
-    char substr[] = "$$";
-    //Char value used to replace substring $$ values
-    char* replace_1 = "%";
-    int substr_size = strlen(substr);
-    //Make a copy of your `string` pointer (for safety)
-    char* ptr = string;
-
-    //Loop through string and replace $$ with pid
-    while (1) {
-        //Find pointer to next substring
-        ptr = strstr(ptr, substr);
-        //If no substring found, then break from the loop
-        if (ptr == NULL) {
-            break;
-        }
-        //If found, then replace it with "%"
-        memset(ptr, *replace_1, substr_size);
-
-        //Replace second character after % with a d to get %d
-        *(ptr + 1) = 'd';
-        //Increment our string pointer, pass replaced substring
-        ptr += substr_size;
+/*
+ * Function:  void* grow_array(void* array, int count, int* capacity, size_t size)
+ * --------------------------------------------------------------------------
+ * Doubles the capacity of a dynamic array when count has reached capacity.
+ * Returns the (possibly moved) array.
+ */
+void* grow_array(void* array, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return array;
     }
-    //Format string %d and replace it with pid
-    sprintf(inputBuffer, string, getpid());
-    //Reset pointers
-    ptr = NULL;
-    replace_1 = NULL;
+    *capacity = (*capacity == 0) ? 16 : *capacity * 2;
+    return realloc(array, (size_t)*capacity * size);
 }
 
 /*
- * Function:  void get_user_input(Commands* cmds) 
+ * Function:  unsigned int history_hash(const char* text, int len)
  * --------------------------------------------------------------------------
- * void get_user_input takes user input into an initial inputBuffer and calls
- * expand_variable if '$$' is present. Then, inputBuffer is tokenized into individual
- * arguments and saved in Commands struct member inputArgs.
- * Then, the function checks for & at the end of arguments to check if the command
- * will be executed in the background or foreground.
- * 
- * Additional functionality:
- *  1. If & is present and foreground only mode is not true,
- *  is_background_process value is set to 1 to indicate the process will be 
- *  run in the background. This is to process & early and remove the &
- *  argument from the array of tokens. This simplifies executing commands 
- *  without the need to worry about "&" still being in inputArgs array of
- *  tokenized commands at the command execution stage in the "main" code block.
- * 
- * Parameters:
- *  Commands* cmds: Pointer to Commands struct
- * 
- * Struct members utilized:
- *  char* inputArgs[MAX_ARGS]: Stores tokenized command arguments
- *  int numArgs: total number of tokenized arguments provided by user
- * 
+ * FNV-1a hash of a command line, used by the history line hash table.
  */
+unsigned int history_hash(const char* text, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-void get_user_input(Commands* cmds) {
-    //Used to store argument tokens
-    char* token;
-    //Input buffer to store initial user input via stdin
-    char inputBuffer[MAX_CHARS_INPUT];
-    //Reset inputBuffer before saving user input
-    memset(inputBuffer, '\0', MAX_CHARS_INPUT);
-
-    //Command line prompt message 
-    fflush(stdout);
-    fflush(stdin);
-    char* prompt = ": ";
-    //Output command line prompt ": "
-    write(STDOUT_FILENO, prompt, strlen(prompt));
-    //clear stdout
-    fflush(stdout);
-
-    //Read user input and save into inputBuffer
-    fgets(inputBuffer, MAX_CHARS_INPUT, stdin);
-    //Delete newline character at the end of user input
-    strtok(inputBuffer, "\n");
-    //Set buffer length 
-    int bufferLength = strlen(inputBuffer);
+/*
+ * Function:  int history_ngram_bucket(const char* text)
+ * --------------------------------------------------------------------------
+ * Hashes the three characters at text into a bucket of the n-gram index.
+ */
+int history_ngram_bucket(const char* text) {
+    unsigned int gram = ((unsigned int)(unsigned char)text[0] << 16) |
+        ((unsigned int)(unsigned char)text[1] << 8) | (unsigned char)text[2];
+    //Multiplicative hash, keep the top HISTORY_NGRAM_BITS bits
+    return (int)((gram * 2654435761u) >> (32 - HISTORY_NGRAM_BITS));
+}
 
-    // $$ Variable expansion
-    //Check for and expand $$ with shell's pid
-    if (strstr(inputBuffer, "$$") != NULL) {
-        //Call expand_variable to expand $$
-        expand_variable(inputBuffer, bufferLength);
+/*
+ * Function:  void history_index_ngrams(History* hist, int lineId)
+ * --------------------------------------------------------------------------
+ * Adds a newly interned line to the posting list of every trigram it contains.
+ * Line ids are added in increasing order, so checking the tail of a posting
+ * list is enough to avoid duplicates.
+ */
+void history_index_ngrams(History* hist, int lineId) {
+    HistLine* line = &hist->lines[lineId];
+    for (int i = 0; i + 3 <= line->len; i++) {
+        HistPostings* postings = &hist->ngrams[history_ngram_bucket(line->text + i)];
+        if (postings->count > 0 && postings->ids[postings->count - 1] == lineId) {
+            continue;
+        }
+        postings->ids = grow_array(postings->ids, postings->count, &postings->capacity, sizeof(int));
+        postings->ids[postings->count++] = lineId;
     }
-    //Reset number of arguments to 0
-    (cmds)->numArgs = 0;
+}
 
-    //Input tokenization step:
-    //Tokenize inputBuffer delimited by spaces " "
-    int arg_count = 0;
-    //Begin tokenization
-    token = strtok(inputBuffer, " ");
-    //Copy initial value to inputArgs array
-    cmds->inputArgs[arg_count] = strdup(token);
-    //For commands or flags following the initial command
-    if (token != NULL) {
-        while (token != NULL)
-        {
-            //Save next token to inputArgs array
-            cmds->inputArgs[arg_count] = strdup(token);
-            //Increment the total count of arguments provide
-            arg_count++;
-            token = strtok(NULL, " \n");
+/*
+ * Function:  void history_table_grow(History* hist)
+ * --------------------------------------------------------------------------
+ * Doubles the line hash table and reinserts every line.
+ */
+void history_table_grow(History* hist) {
+    int capacity = (hist->tableCapacity == 0) ? HISTORY_HASH_INIT : hist->tableCapacity * 2;
+    int* table = calloc(capacity, sizeof(int));
+    for (int id = 0; id < hist->lineCount; id++) {
+        int slot = hist->lines[id].hash & (capacity - 1);
+        while (table[slot] != 0) {
+            slot = (slot + 1) & (capacity - 1);
         }
+        table[slot] = id + 1;
     }
-    //Set null pointer at the end of inputArgs array
-    cmds->inputArgs[arg_count + 1] = '\0';
-    //Save the total count of arguments
-    ((cmds)->numArgs) = arg_count;
-    //Free memory for token
-    free(token);
-    prompt = NULL;
-    //Reset token to NULL
-    token = NULL;
-
-    //Set num as a temp variable to save values of numArgs
-    int num = cmds->numArgs;
+    free(hist->table);
+    hist->table = table;
+    hist->tableCapacity = capacity;
+}
 
-    // Check for & at the end of arguments
-    // If & is present and foreground only mode is not true,
-    // is_background_process value is set to 1 to indicate the process will be
-    // run in the background
-    if (strcmp(cmds->inputArgs[num - 1], "&") == 0) {
-        //make sure the array position is not null and the final 
-        cmds->inputArgs[num - 1] = '\0';
-        //Decrement total number of arguments to account for the removal of "&"
-        cmds->numArgs = num - 1;
-        //Check if foreground only mode is active
-        if (foreground_only_mode == false) {
-            //Set background flag to run command in background
-            cmds->is_background_process = 1;
-        }
-        else {
-            //Set background flag to 0
-            //if foreground only mode is active
-            cmds->is_background_process = 0;
+/*
+ * Function:  int history_intern(History* hist, const char* text, int len, bool copy)
+ * --------------------------------------------------------------------------
+ * Looks up a command line in the history hash table and returns its line id.
+ * Unknown lines are added to the table and the n-gram index.
+ *
+ * Parameters:
+ *  const char* text, int len: command line (does not need a null terminator)
+ *  bool copy: true to keep a heap copy of text, false if text outlives the history
+ */
+int history_intern(History* hist, const char* text, int len, bool copy) {
+    unsigned int hash = history_hash(text, len);
+    //Keep the table at most half full
+    if ((hist->lineCount + 1) * 2 > hist->tableCapacity) {
+        history_table_grow(hist);
+    }
+    int slot = hash & (hist->tableCapacity - 1);
+    while (hist->table[slot] != 0) {
+        HistLine* line = &hist->lines[hist->table[slot] - 1];
+        if (line->hash == hash && line->len == len && memcmp(line->text, text, len) == 0) {
+            return hist->table[slot] - 1;
         }
+        slot = (slot + 1) & (hist->tableCapacity - 1);
     }
-    memset(inputBuffer, '\0', MAX_ARGS);
+    //First time this line is seen
+    hist->lines = grow_array(hist->lines, hist->lineCount, &hist->lineCapacity, sizeof(HistLine));
+    HistLine* line = &hist->lines[hist->lineCount];
+    line->text = copy ? strndup(text, len) : text;
+    line->len = len;
+    line->hash = hash;
+    line->lastEntry = -1;
+    line->owned = copy;
+    hist->table[slot] = hist->lineCount + 1;
+    history_index_ngrams(hist, hist->lineCount);
+    return hist->lineCount++;
 }
 
+/*
+ * Function:  void history_append_entry(History* hist, int lineId, int status, long duration_ms)
+ * --------------------------------------------------------------------------
+ * Adds an executed command to the in-memory history and makes it the most
+ * recent entry of its line.
+ */
+void history_append_entry(History* hist, int lineId, int status, long duration_ms) {
+    hist->entries = grow_array(hist->entries, hist->entryCount, &hist->entryCapacity, sizeof(HistEntry));
+    HistEntry* entry = &hist->entries[hist->entryCount];
+    entry->lineId = lineId;
+    entry->status = status;
+    entry->duration_ms = duration_ms;
+    hist->lines[lineId].lastEntry = hist->entryCount;
+    hist->entryCount++;
+}
 
 /*
- * Function:  void exec_other_commands(Commands* cmds)
+ * Function:  long history_parse_number(const char** cursor, const char* end)
  * --------------------------------------------------------------------------
- * Takes a pointer to Commands struct as a paraemter and runs non built-in commands.
- * Handles redirect commands as well. Commands are excuted via
- * execvp(cmds->inputArgs[0], cmds->inputArgs). Helps separate responsibilities 
- * of built-in commands and non built-in commands.
- * 
- *  Overall structure:
+ * Parses an optionally negative decimal number from a record in the mapped
+ * history file without reading past end, and advances cursor past it.
+ */
+long history_parse_number(const char** cursor, const char* end) {
+    const char* p = *cursor;
+    bool negative = false;
+    long value = 0;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    *cursor = p;
+    return negative ? -value : value;
+}
+
+/*
+ * Function:  void history_parse_record(History* hist, const char* record, int len)
+ * --------------------------------------------------------------------------
+ * Adds one record of the mapped history file to the history. Lines that are
+ * not in the ": status:duration;command" format are kept as plain commands.
+ * The command text is not copied, it stays in the mapping.
+ */
+void history_parse_record(History* hist, const char* record, int len) {
+    const char* end = record + len;
+    const char* text = record;
+    int status = HISTORY_STATUS_UNKNOWN;
+    long duration_ms = 0;
+
+    if (len > 2 && record[0] == ':' && record[1] == ' ') {
+        const char* cursor = record + 2;
+        long parsedStatus = history_parse_number(&cursor, end);
+        if (cursor < end && *cursor == ':') {
+            cursor++;
+            long parsedDuration = history_parse_number(&cursor, end);
+            if (cursor < end && *cursor == ';') {
+                status = (int)parsedStatus;
+                duration_ms = parsedDuration;
+                text = cursor + 1;
+            }
+        }
+    }
+    //Skip blank records (e.g. a record torn by a crash)
+    if (text >= end) {
+        return;
+    }
+    history_append_entry(hist, history_intern(hist, text, end - text, false), status, duration_ms);
+}
+
+/*
+ * Function:  void history_load(History* hist)
+ * --------------------------------------------------------------------------
+ * Opens the history file ($SMALLSH_HISTFILE or ~/.smallsh_history) for
+ * appending and maps its current contents read-only, then builds the line
+ * hash table and n-gram index over the mapped records. If the file cannot
+ * be opened the history is kept in memory only.
+ */
+void history_load(History* hist) {
+    memset(hist, 0, sizeof(History));
+    hist->fd = -1;
+    hist->ngrams = calloc(HISTORY_NGRAM_BUCKETS, sizeof(HistPostings));
+
+    //Resolve the history file path
+    char path[MAX_CHARS_INPUT];
+    char* histFile = getenv(HISTORY_FILE_ENV);
+    char* home = getenv("HOME");
+    if (histFile != NULL && histFile[0] != '\0') {
+        snprintf(path, sizeof(path), "%s", histFile);
+    }
+    else if (home != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE_NAME);
+    }
+    else {
+        return;
+    }
+
+    //O_APPEND makes every write() land atomically at the end of the file
+    hist->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (hist->fd == -1) {
+        fprintf(stderr, "cannot open history file %s\n", path);
+        fflush(stdout);
+        return;
+    }
+    struct stat info;
+    if (fstat(hist->fd, &info) == -1 || info.st_size == 0) {
+        return;
+    }
+    hist->map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, hist->fd, 0);
+    if (hist->map == MAP_FAILED) {
+        hist->map = NULL;
+        return;
+    }
+    hist->mapLen = info.st_size;
+    madvise(hist->map, hist->mapLen, MADV_SEQUENTIAL);
+
+    //Split the mapping into records
+    const char* cursor = hist->map;
+    const char* end = hist->map + hist->mapLen;
+    while (cursor < end) {
+        const char* newline = memchr(cursor, '\n', end - cursor);
+        const char* recordEnd = (newline != NULL) ? newline : end;
+        history_parse_record(hist, cursor, recordEnd - cursor);
+        cursor = recordEnd + 1;
+    }
+}
+
+/*
+ * Function:  void history_add(History* hist, const char* line, int status, long duration_ms)
+ * --------------------------------------------------------------------------
+ * Records an executed command. The record is appended to the history file
+ * with a single write() and added to the in-memory index.
+ *
+ * Parameters:
+ *  const char* line: command line as entered
+ *  int status: wait status of the command (0 for built-in commands)
+ *  long duration_ms: run time of the command in milliseconds
+ */
+void history_add(History* hist, const char* line, int status, long duration_ms) {
+    int len = strlen(line);
+    if (len == 0) {
+        return;
+    }
+    if (hist->fd != -1) {
+        char record[MAX_CHARS_INPUT + 64];
+        int recordLen = snprintf(record, sizeof(record), ": %d:%ld;%s\n", status, duration_ms, line);
+        if (recordLen >= (int)sizeof(record)) {
+            recordLen = sizeof(record) - 1;
+            record[recordLen - 1] = '\n';
+        }
+        if (write(hist->fd, record, recordLen) != recordLen) {
+            fprintf(stderr, "cannot write history file\n");
+            fflush(stdout);
+        }
+    }
+    history_append_entry(hist, history_intern(hist, line, len, true), status, duration_ms);
+}
+
+/*
+ * Function:  void history_close(History* hist)
+ * --------------------------------------------------------------------------
+ * Unmaps the history file, closes it and frees the history index.
+ */
+void history_close(History* hist) {
+    for (int id = 0; id < hist->lineCount; id++) {
+        if (hist->lines[id].owned) {
+            free((char*)hist->lines[id].text);
+        }
+    }
+    for (int bucket = 0; hist->ngrams != NULL && bucket < HISTORY_NGRAM_BUCKETS; bucket++) {
+        free(hist->ngrams[bucket].ids);
+    }
+    free(hist->ngrams);
+    free(hist->lines);
+    free(hist->table);
+    free(hist->entries);
+    if (hist->map != NULL) {
+        munmap(hist->map, hist->mapLen);
+    }
+    if (hist->fd != -1) {
+        close(hist->fd);
+    }
+    memset(hist, 0, sizeof(History));
+    hist->fd = -1;
+}
+
+/*
+ * Function:  HistPostings* history_rarest_ngram(History* hist, const char* text, int len)
+ * --------------------------------------------------------------------------
+ * Returns the shortest posting list among the trigrams of text. Every line
+ * containing text is in that list. Returns NULL if text is shorter than a
+ * trigram, in which case callers fall back to a scan.
+ */
+HistPostings* history_rarest_ngram(History* hist, const char* text, int len) {
+    HistPostings* rarest = NULL;
+    for (int i = 0; i + 3 <= len; i++) {
+        HistPostings* postings = &hist->ngrams[history_ngram_bucket(text + i)];
+        if (rarest == NULL || postings->count < rarest->count) {
+            rarest = postings;
+        }
+    }
+    return rarest;
+}
+
+/*
+ * Function:  int history_find_prefix(History* hist, const char* prefix)
+ * --------------------------------------------------------------------------
+ * Returns the most recent entry whose command starts with prefix, -1 if none.
+ */
+int history_find_prefix(History* hist, const char* prefix) {
+    int len = strlen(prefix);
+    HistPostings* postings = history_rarest_ngram(hist, prefix, len);
+    //Short prefix: walk back from the newest entry
+    if (postings == NULL) {
+        for (int entry = hist->entryCount - 1; entry >= 0; entry--) {
+            HistLine* line = &hist->lines[hist->entries[entry].lineId];
+            if (line->len >= len && memcmp(line->text, prefix, len) == 0) {
+                return entry;
+            }
+        }
+        return -1;
+    }
+    int best = -1;
+    for (int i = 0; i < postings->count; i++) {
+        HistLine* line = &hist->lines[postings->ids[i]];
+        if (line->lastEntry > best && line->len >= len && memcmp(line->text, prefix, len) == 0) {
+            best = line->lastEntry;
+        }
+    }
+    return best;
+}
+
+/*
+ * Function:  void history_print_entry(History* hist, int entry)
+ * --------------------------------------------------------------------------
+ * Prints one history entry: number, exit status or signal, duration, command.
+ */
+void history_print_entry(History* hist, int entry) {
+    HistEntry* e = &hist->entries[entry];
+    HistLine* line = &hist->lines[e->lineId];
+    char status[32];
+    if (e->status == HISTORY_STATUS_UNKNOWN) {
+        strcpy(status, "-");
+    }
+    else if (WIFEXITED(e->status)) {
+        snprintf(status, sizeof(status), "exit %d", WEXITSTATUS(e->status));
+    }
+    else {
+        snprintf(status, sizeof(status), "signal %d", WTERMSIG(e->status));
+    }
+    printf("%5d  %-10s %8ldms  %.*s\n", entry + 1, status, e->duration_ms, line->len, line->text);
+}
+
+/*
+ * Function:  void history_search(History* hist, const char* needle)
+ * --------------------------------------------------------------------------
+ * Prints every history entry whose command contains needle. Candidate lines
+ * come from the n-gram index and are verified with memmem(); matching lines
+ * are then printed in entry order.
+ */
+void history_search(History* hist, const char* needle) {
+    int len = strlen(needle);
+    bool* matched = calloc(hist->lineCount + 1, sizeof(bool));
+    HistPostings* postings = history_rarest_ngram(hist, needle, len);
+    if (postings != NULL) {
+        for (int i = 0; i < postings->count; i++) {
+            HistLine* line = &hist->lines[postings->ids[i]];
+            matched[postings->ids[i]] = memmem(line->text, line->len, needle, len) != NULL;
+        }
+    }
+    else {
+        for (int id = 0; id < hist->lineCount; id++) {
+            matched[id] = memmem(hist->lines[id].text, hist->lines[id].len, needle, len) != NULL;
+        }
+    }
+    for (int entry = 0; entry < hist->entryCount; entry++) {
+        if (matched[hist->entries[entry].lineId]) {
+            history_print_entry(hist, entry);
+        }
+    }
+    fflush(stdout);
+    free(matched);
+}
+
+/*
+ * Function:  void history_command(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Built-in "history" command.
+ *  history            print every entry
+ *  history N          print the last N entries
+ *  history -s TEXT    print entries whose command contains TEXT
+ *
+ * Parameters:
+ *  Commands* cmds: pointer to Commands struct
+ *
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS]: Stores tokenized command arguments
+ *  int numArgs: Total number of tokenized command arguments
+ *  History history: persistent command history
+ */
+void history_command(Commands* cmds) {
+    History* hist = &cmds->history;
+    if (cmds->numArgs > 2 && strcmp(cmds->inputArgs[1], "-s") == 0) {
+        //Rejoin the words after -s, the tokenizer split them on spaces
+        char needle[MAX_CHARS_INPUT] = "";
+        for (int i = 2; i < cmds->numArgs; i++) {
+            if (i > 2) {
+                strcat(needle, " ");
+            }
+            strcat(needle, cmds->inputArgs[i]);
+        }
+        history_search(hist, needle);
+        return;
+    }
+    int first = 0;
+    if (cmds->numArgs > 1) {
+        char* end;
+        long count = strtol(cmds->inputArgs[1], &end, 10);
+        //"-s" without search text, an unknown option or extra words
+        if (cmds->numArgs > 2 || end == cmds->inputArgs[1] || *end != '\0' || count < 0) {
+            fprintf(stderr, "usage: history [N] | history -s TEXT\n");
+            fflush(stdout);
+            return;
+        }
+        if (count > 0 && count < hist->entryCount) {
+            first = hist->entryCount - count;
+        }
+    }
+    for (int entry = first; entry < hist->entryCount; entry++) {
+        history_print_entry(hist, entry);
+    }
+    fflush(stdout);
+}
+
+/*
+ * Function:  bool history_expand(History* hist, char* inputBuffer)
+ * --------------------------------------------------------------------------
+ * Expands a history event at the start of the command line:
+ *  !!        last command
+ *  !n        command number n
+ *  !-n       n-th previous command
+ *  !prefix   most recent command starting with prefix
+ * Any words after the event are kept. The expanded line is echoed like bash.
+ * Returns false and empties inputBuffer if the event is not found.
+ */
+bool history_expand(History* hist, char* inputBuffer) {
+    if (inputBuffer[0] != '!' || inputBuffer[1] == '\0' || inputBuffer[1] == ' ') {
+        return true;
+    }
+    //Split the event designator from the rest of the line
+    char* rest = strchr(inputBuffer, ' ');
+    int designatorLen = (rest != NULL) ? rest - inputBuffer - 1 : (int)strlen(inputBuffer) - 1;
+    char designator[MAX_CHARS_INPUT];
+    memcpy(designator, inputBuffer + 1, designatorLen);
+    designator[designatorLen] = '\0';
+
+    int entry;
+    char* digits = (designator[0] == '-') ? designator + 1 : designator;
+    if (strcmp(designator, "!") == 0) {
+        entry = hist->entryCount - 1;
+    }
+    else if (digits[0] != '\0' && strspn(digits, "0123456789") == strlen(digits)) {
+        int n = atoi(designator);
+        entry = (n > 0) ? n - 1 : hist->entryCount + n;
+    }
+    else {
+        entry = history_find_prefix(hist, designator);
+    }
+    if (entry < 0 || entry >= hist->entryCount) {
+        fprintf(stderr, "!%s: event not found\n", designator);
+        fflush(stdout);
+        inputBuffer[0] = '\0';
+        return false;
+    }
+
+    HistLine* line = &hist->lines[hist->entries[entry].lineId];
+    char expanded[MAX_CHARS_INPUT];
+    snprintf(expanded, sizeof(expanded), "%.*s%s", line->len, line->text, (rest != NULL) ? rest : "");
+    strcpy(inputBuffer, expanded);
+    printf("%s\n", inputBuffer);
+    fflush(stdout);
+    return true;
+}
+
+/*
+ * Function:  bool parse_duration(const char* text, long* duration_ms)
+ * --------------------------------------------------------------------------
+ * Parses a duration such as "10", "2.5s", "500ms", "3m" or "1h" into
+ * milliseconds. A number without a suffix is in seconds.
+ * Returns false if text is not a valid, positive duration.
+ */
+bool parse_duration(const char* text, long* duration_ms) {
+    char* suffix;
+    double value = strtod(text, &suffix);
+    double scale;
+    if (suffix == text || value <= 0) {
+        return false;
+    }
+    if (strcmp(suffix, "") == 0 || strcmp(suffix, "s") == 0) {
+        scale = 1000;
+    }
+    else if (strcmp(suffix, "ms") == 0) {
+        scale = 1;
+    }
+    else if (strcmp(suffix, "m") == 0) {
+        scale = 60 * 1000;
+    }
+    else if (strcmp(suffix, "h") == 0) {
+        scale = 60 * 60 * 1000;
+    }
+    else {
+        return false;
+    }
+    *duration_ms = (long)(value * scale);
+    return *duration_ms > 0;
+}
+
+/*
+ * Function:  void remove_args(Commands* cmds, int first, int count)
+ * --------------------------------------------------------------------------
+ * Frees count tokens of inputArgs starting at first and shifts the
+ * remaining tokens down, keeping inputArgs null terminated.
+ */
+void remove_args(Commands* cmds, int first, int count) {
+    for (int i = first; i < first + count; i++) {
+        free(cmds->inputArgs[i]);
+    }
+    for (int i = first; i + count <= cmds->numArgs; i++) {
+        cmds->inputArgs[i] = cmds->inputArgs[i + count];
+    }
+    cmds->numArgs -= count;
+    cmds->inputArgs[cmds->numArgs] = NULL;
+}
+
+/*
+ * Function:  void parse_deadline_options(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Called by get_user_input after "&" has been removed. Strips the deadline
+ * syntax from inputArgs and saves it in deadline_ms / grace_ms:
+ *  timeout [-k GRACE] DURATION command [args...]
+ *  command [args...] --deadline DURATION [< in] [> out]
+ * If the duration is invalid an error is printed and inputArgs is emptied
+ * so that nothing is executed.
+ *
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS], int numArgs: tokenized command
+ *  long deadline_ms, long grace_ms: parsed deadline and grace period
+ */
+void parse_deadline_options(Commands* cmds) {
+    //Option in front of the command
+    if (cmds->numArgs > 0 && strcmp(cmds->inputArgs[0], "timeout") == 0) {
+        int arg = 1;
+        if (arg + 1 < cmds->numArgs && strcmp(cmds->inputArgs[arg], "-k") == 0) {
+            if (!parse_duration(cmds->inputArgs[arg + 1], &cmds->grace_ms)) {
+                fprintf(stderr, "timeout: invalid duration %s\n", cmds->inputArgs[arg + 1]);
+                fflush(stdout);
+                reset_inputArgs(cmds);
+                return;
+            }
+            arg += 2;
+        }
+        if (arg + 1 >= cmds->numArgs || !parse_duration(cmds->inputArgs[arg], &cmds->deadline_ms)) {
+            fprintf(stderr, "usage: timeout [-k GRACE] DURATION command\n");
+            fflush(stdout);
+            reset_inputArgs(cmds);
+            return;
+        }
+        remove_args(cmds, 0, arg + 1);
+    }
+    //Option after the command arguments, redirections come after it
+    int end = 0;
+    while (end < cmds->numArgs && strcmp(cmds->inputArgs[end], "<") != 0 && strcmp(cmds->inputArgs[end], ">") != 0) {
+        end++;
+    }
+    if (end > 2 && strcmp(cmds->inputArgs[end - 2], "--deadline") == 0) {
+        if (!parse_duration(cmds->inputArgs[end - 1], &cmds->deadline_ms)) {
+            fprintf(stderr, "--deadline: invalid duration %s\n", cmds->inputArgs[end - 1]);
+            fflush(stdout);
+            reset_inputArgs(cmds);
+            return;
+        }
+        remove_args(cmds, end - 2, 2);
+    }
+}
+
+/*
+ * Function:  bool parse_limit_value(int limit, const char* text, rlim_t* value)
+ * --------------------------------------------------------------------------
+ * Parses the value of a resource limit option. "unlimited" is accepted for
+ * every limit. Address space takes a size in KiB or with a K, M or G suffix
+ * (like ulimit -v), CPU time takes seconds or a duration like "2m", the
+ * other limits take a count.
+ * Returns false if text is not a valid value.
+ */
+bool parse_limit_value(int limit, const char* text, rlim_t* value) {
+    char* suffix;
+    if (strcmp(text, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+    if (limit == LIMIT_CPU) {
+        long duration_ms;
+        if (!parse_duration(text, &duration_ms)) {
+            return false;
+        }
+        //Whole seconds, rounded up
+        *value = (duration_ms + 999) / 1000;
+        return true;
+    }
+    unsigned long long number = strtoull(text, &suffix, 10);
+    if (suffix == text || text[0] == '-') {
+        return false;
+    }
+    if (limit == LIMIT_AS) {
+        if (strcmp(suffix, "") == 0 || strcasecmp(suffix, "K") == 0) {
+            number *= 1024;
+        }
+        else if (strcasecmp(suffix, "M") == 0) {
+            number *= 1024 * 1024;
+        }
+        else if (strcasecmp(suffix, "G") == 0) {
+            number *= 1024 * 1024 * 1024;
+        }
+        else {
+            return false;
+        }
+    }
+    else if (*suffix != '\0') {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+/*
+ * Function:  int parse_limit_arguments(Limits* limits, char** args, int count, int* used)
+ * --------------------------------------------------------------------------
+ * Parses "-v SIZE -t SECONDS -u COUNT -n COUNT" options from args into
+ * limits, stopping at the first word that is not an option. The number of
+ * words consumed is saved in used. Returns false (after printing an error)
+ * if an option or value is invalid.
+ */
+bool parse_limit_arguments(Limits* limits, char** args, int count, int* used) {
+    int i = 0;
+    while (i < count && args[i][0] == '-' && args[i][1] != '\0' && args[i][2] == '\0') {
+        int limit = 0;
+        while (limit < LIMIT_COUNT && limit_options[limit].option != args[i][1]) {
+            limit++;
+        }
+        if (limit == LIMIT_COUNT || i + 1 >= count ||
+            !parse_limit_value(limit, args[i + 1], &limits->value[limit])) {
+            fprintf(stderr, "invalid limit %s %s\n", args[i], (i + 1 < count) ? args[i + 1] : "");
+            fflush(stdout);
+            return false;
+        }
+        limits->set[limit] = true;
+        i += 2;
+    }
+    *used = i;
+    return true;
+}
+
+/*
+ * Function:  void parse_limit_options(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Strips a "limit [-v SIZE] [-t SECONDS] [-u COUNT] [-n COUNT]" prefix from
+ * inputArgs and adds those limits to the limits of the current command
+ * (which start as the ulimit defaults). If the prefix is invalid, inputArgs
+ * is emptied so that nothing is executed.
+ *
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS], int numArgs: tokenized command
+ *  Limits limits: resource limits of the current command
+ */
+void parse_limit_options(Commands* cmds) {
+    int used;
+    if (cmds->numArgs == 0 || strcmp(cmds->inputArgs[0], "limit") != 0) {
+        return;
+    }
+    if (!parse_limit_arguments(&cmds->limits, cmds->inputArgs + 1, cmds->numArgs - 1, &used)) {
+        reset_inputArgs(cmds);
+        return;
+    }
+    if (used + 1 >= cmds->numArgs) {
+        fprintf(stderr, "usage: limit [-v SIZE] [-t SECONDS] [-u COUNT] [-n COUNT] command\n");
+        fflush(stdout);
+        reset_inputArgs(cmds);
+        return;
+    }
+    remove_args(cmds, 0, used + 1);
+}
+
+/*
+ * Function:  void apply_limits(Limits* limits)
+ * --------------------------------------------------------------------------
+ * Called in the child process right before execvp. Sets every limit that is
+ * set in limits with setrlimit(). The hard CPU limit is one second above the
+ * soft one, so the process first gets SIGXCPU, which tells the shell which
+ * limit stopped it. Limits above the current hard limit are clamped to it.
+ */
+void apply_limits(Limits* limits) {
+    for (int limit = 0; limit < LIMIT_COUNT; limit++) {
+        if (!limits->set[limit]) {
+            continue;
+        }
+        struct rlimit current;
+        struct rlimit wanted;
+        getrlimit(limit_options[limit].resource, &current);
+        wanted.rlim_cur = limits->value[limit];
+        wanted.rlim_max = limits->value[limit];
+        if (limit == LIMIT_CPU && wanted.rlim_max != RLIM_INFINITY) {
+            wanted.rlim_max++;
+        }
+        //Only a privileged process can raise its hard limit
+        if (current.rlim_max != RLIM_INFINITY &&
+            (wanted.rlim_max == RLIM_INFINITY || wanted.rlim_max > current.rlim_max)) {
+            wanted.rlim_max = current.rlim_max;
+            if (wanted.rlim_cur == RLIM_INFINITY || wanted.rlim_cur > current.rlim_max) {
+                wanted.rlim_cur = current.rlim_max;
+            }
+        }
+        if (setrlimit(limit_options[limit].resource, &wanted) == -1) {
+            fprintf(stderr, "cannot set %s limit\n", limit_options[limit].name);
+            fflush(stderr);
+        }
+    }
+}
+
+/*
+ * Function:  rlim_t limit_value(Limits* limits, int limit)
+ * --------------------------------------------------------------------------
+ * Returns the soft limit a command got: its own value, or the shell's limit
+ * if it was not set.
+ */
+rlim_t limit_value(Limits* limits, int limit) {
+    struct rlimit current;
+    if (limits->set[limit]) {
+        return limits->value[limit];
+    }
+    if (getrlimit(limit_options[limit].resource, &current) == -1) {
+        return RLIM_INFINITY;
+    }
+    return current.rlim_cur;
+}
+
+/*
+ * Function:  const char* limit_exceeded(Limits* limits, int status, struct rusage* usage)
+ * --------------------------------------------------------------------------
+ * Returns a description of the resource limit that stopped a process with
+ * wait status status and resource usage usage (from wait4), NULL if it was
+ * not stopped by a limit.
+ *  SIGXCPU or SIGKILL (at the hard limit) is the CPU time limit only if the
+ *  process used at least that much CPU time, otherwise it was sent by someone.
+ *  SIGSEGV, SIGBUS or SIGABRT of a process with an address space limit may
+ *  be a failed allocation or stack growth, but may just as well be a bug, so
+ *  it is only reported as possible.
+ * Running out of processes or open files makes the command's own system
+ * calls fail and is reported by the command itself.
+ */
+const char* limit_exceeded(Limits* limits, int status, struct rusage* usage) {
+    if (!WIFSIGNALED(status)) {
+        return NULL;
+    }
+    int signo = WTERMSIG(status);
+    if (signo == SIGXCPU || signo == SIGKILL) {
+        rlim_t cpuLimit = limit_value(limits, LIMIT_CPU);
+        long cpuMs = (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000 +
+            (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000;
+        //The limit is checked on clock ticks but rusage is scaled, so it can read a few ms short
+        if (cpuLimit != RLIM_INFINITY && (rlim_t)(cpuMs + CPU_LIMIT_SLACK_MS) >= cpuLimit * 1000) {
+            return "exceeded CPU time limit (RLIMIT_CPU)";
+        }
+    }
+    if ((signo == SIGSEGV || signo == SIGBUS || signo == SIGABRT) &&
+        limits->set[LIMIT_AS] && limits->value[LIMIT_AS] != RLIM_INFINITY) {
+        return "possibly exceeded address space limit (RLIMIT_AS)";
+    }
+    return NULL;
+}
+
+/*
+ * Function:  void ulimit_command(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Built-in "ulimit" command, sets the default resource limits of every
+ * command started by the shell (the shell itself is not limited).
+ *  ulimit                          print the limits commands get
+ *  ulimit [-v SIZE] [-t SECONDS] [-u COUNT] [-n COUNT]   set defaults
+ * A single command can add to the defaults with the "limit" prefix.
+ *
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS], int numArgs: tokenized command
+ *  Limits default_limits: limits applied to every command
+ */
+void ulimit_command(Commands* cmds) {
+    int used;
+    Limits limits = cmds->default_limits;
+    if (!parse_limit_arguments(&limits, cmds->inputArgs + 1, cmds->numArgs - 1, &used)) {
+        return;
+    }
+    if (used + 1 < cmds->numArgs) {
+        fprintf(stderr, "usage: ulimit [-v SIZE] [-t SECONDS] [-u COUNT] [-n COUNT]\n");
+        fflush(stdout);
+        return;
+    }
+    if (used > 0) {
+        cmds->default_limits = limits;
+        return;
+    }
+    for (int limit = 0; limit < LIMIT_COUNT; limit++) {
+        rlim_t value = limits.value[limit];
+        //Not set: commands inherit the shell's own limit
+        if (!limits.set[limit]) {
+            struct rlimit current;
+            getrlimit(limit_options[limit].resource, &current);
+            value = current.rlim_cur;
+        }
+        if (value == RLIM_INFINITY) {
+            printf("%-14s (-%c)  unlimited\n", limit_options[limit].name, limit_options[limit].option);
+        }
+        else if (limit == LIMIT_AS) {
+            printf("%-14s (-%c)  %lluK\n", limit_options[limit].name, limit_options[limit].option,
+                (unsigned long long)value / 1024);
+        }
+        else {
+            printf("%-14s (-%c)  %llu\n", limit_options[limit].name, limit_options[limit].option,
+                (unsigned long long)value);
+        }
+    }
+    fflush(stdout);
+}
+
+/*
+ * Function:  int timespec_compare(struct timespec* a, struct timespec* b)
+ * --------------------------------------------------------------------------
+ * Returns a negative value, 0 or a positive value if a is before, equal to
+ * or after b.
+ */
+int timespec_compare(struct timespec* a, struct timespec* b) {
+    if (a->tv_sec != b->tv_sec) {
+        return (a->tv_sec < b->tv_sec) ? -1 : 1;
+    }
+    return (a->tv_nsec < b->tv_nsec) ? -1 : (a->tv_nsec > b->tv_nsec);
+}
+
+/*
+ * Function:  void timespec_add_ms(struct timespec* time, long ms)
+ * --------------------------------------------------------------------------
+ * Adds ms milliseconds to time.
+ */
+void timespec_add_ms(struct timespec* time, long ms) {
+    time->tv_sec += ms / 1000;
+    time->tv_nsec += (ms % 1000) * 1000000;
+    if (time->tv_nsec >= 1000000000) {
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Function:  bool deadline_before(Commands* cmds, int a, int b)
+ * --------------------------------------------------------------------------
+ * Heap order of the deadlines array. Deadlines whose process was already
+ * sent SIGKILL never expire again and sort last.
+ */
+bool deadline_before(Commands* cmds, int a, int b) {
+    Deadline* first = &cmds->deadlines[a];
+    Deadline* second = &cmds->deadlines[b];
+    if ((first->stage == DEADLINE_DONE) != (second->stage == DEADLINE_DONE)) {
+        return second->stage == DEADLINE_DONE;
+    }
+    return timespec_compare(&first->when, &second->when) < 0;
+}
+
+/*
+ * Function:  void deadline_swap(Commands* cmds, int a, int b)
+ * --------------------------------------------------------------------------
+ * Swaps two entries of the deadline heap.
+ */
+void deadline_swap(Commands* cmds, int a, int b) {
+    Deadline temp = cmds->deadlines[a];
+    cmds->deadlines[a] = cmds->deadlines[b];
+    cmds->deadlines[b] = temp;
+}
+
+/*
+ * Function:  void deadline_sift(Commands* cmds, int i)
+ * --------------------------------------------------------------------------
+ * Restores the heap order after the entry at index i was added or changed.
+ */
+void deadline_sift(Commands* cmds, int i) {
+    //Move up while earlier than the parent
+    while (i > 0 && deadline_before(cmds, i, (i - 1) / 2)) {
+        deadline_swap(cmds, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    //Move down while later than a child
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < cmds->deadline_count && deadline_before(cmds, left, smallest)) {
+            smallest = left;
+        }
+        if (right < cmds->deadline_count && deadline_before(cmds, right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        deadline_swap(cmds, i, smallest);
+        i = smallest;
+    }
+}
+
+/*
+ * Function:  void deadline_arm_timer(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Arms timer_fd for the earliest pending deadline, or disarms it if there
+ * is nothing left to expire.
+ */
+void deadline_arm_timer(Commands* cmds) {
+    struct itimerspec timer = { 0 };
+    if (cmds->timer_fd == -1) {
+        return;
+    }
+    if (cmds->deadline_count > 0 && cmds->deadlines[0].stage != DEADLINE_DONE) {
+        timer.it_value = cmds->deadlines[0].when;
+    }
+    timerfd_settime(cmds->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+/*
+ * Function:  void deadline_add(Commands* cmds, pid_t pid)
+ * --------------------------------------------------------------------------
+ * Adds a deadline for pid deadline_ms from now, using the deadline_ms and
+ * grace_ms parsed from the current command.
+ */
+void deadline_add(Commands* cmds, pid_t pid) {
+    if (cmds->deadline_count == MAX_ARGS) {
+        fprintf(stderr, "too many deadlines, pid %d has none\n", pid);
+        fflush(stdout);
+        return;
+    }
+    Deadline* deadline = &cmds->deadlines[cmds->deadline_count];
+    clock_gettime(CLOCK_MONOTONIC, &deadline->when);
+    timespec_add_ms(&deadline->when, cmds->deadline_ms);
+    deadline->pid = pid;
+    deadline->grace_ms = cmds->grace_ms;
+    deadline->stage = DEADLINE_TERM;
+    cmds->deadline_count++;
+    deadline_sift(cmds, cmds->deadline_count - 1);
+    deadline_arm_timer(cmds);
+}
+
+/*
+ * Function:  bool deadline_remove(Commands* cmds, pid_t pid)
+ * --------------------------------------------------------------------------
+ * Removes the deadline of a reaped process. Returns true if the process had
+ * already been signalled because its deadline expired.
+ */
+bool deadline_remove(Commands* cmds, pid_t pid) {
+    for (int i = 0; i < cmds->deadline_count; i++) {
+        if (cmds->deadlines[i].pid == pid) {
+            bool expired = cmds->deadlines[i].stage != DEADLINE_TERM;
+            //Replace with the last entry and restore the heap order
+            cmds->deadline_count--;
+            if (i < cmds->deadline_count) {
+                cmds->deadlines[i] = cmds->deadlines[cmds->deadline_count];
+                deadline_sift(cmds, i);
+            }
+            deadline_arm_timer(cmds);
+            return expired;
+        }
+    }
+    return false;
+}
+
+/*
+ * Function:  void deadline_expire(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Called when timer_fd fires. Sends SIGTERM to every process whose deadline
+ * has passed and reschedules it grace_ms later; processes still running when
+ * that grace period ends are sent SIGKILL.
+ */
+void deadline_expire(Commands* cmds) {
+    uint64_t expirations;
+    struct timespec now;
+    //Clear the timerfd readiness
+    read(cmds->timer_fd, &expirations, sizeof(expirations));
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (cmds->deadline_count > 0 && cmds->deadlines[0].stage != DEADLINE_DONE &&
+        timespec_compare(&cmds->deadlines[0].when, &now) <= 0) {
+        Deadline* deadline = &cmds->deadlines[0];
+        if (deadline->stage == DEADLINE_TERM) {
+            kill(deadline->pid, SIGTERM);
+            deadline->stage = DEADLINE_KILL;
+            timespec_add_ms(&deadline->when, deadline->grace_ms);
+        }
+        else {
+            kill(deadline->pid, SIGKILL);
+            deadline->stage = DEADLINE_DONE;
+        }
+        deadline_sift(cmds, 0);
+    }
+    deadline_arm_timer(cmds);
+}
+
+/*
+ * Function:  void drain_sigchld_pipe()
+ * --------------------------------------------------------------------------
+ * Empties the SIGCHLD self-pipe once its wakeup has been handled.
+ */
+void drain_sigchld_pipe() {
+    char buffer[64];
+    while (read(sigchld_pipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+/*
+ * Function:  void wait_foreground(Commands* cmds, pid_t pid)
+ * --------------------------------------------------------------------------
+ * Waits for the foreground process pid and saves its status in processStatus
+ * and its resource usage in processUsage.
+ * Without pending deadlines this is a plain blocking wait4. Otherwise the
+ * shell polls the timerfd and the SIGCHLD self-pipe so that deadlines (of
+ * this process and of background processes) are enforced while waiting.
+ *
+ * Struct members utilized:
+ *  int processStatus: status of the foreground process
+ *  struct rusage processUsage: resource usage of the foreground process
+ *  bool timedOut: set if the process was stopped by its deadline
+ */
+void wait_foreground(Commands* cmds, pid_t pid) {
+    if (cmds->deadline_count == 0 || cmds->timer_fd == -1) {
+        wait4(pid, &(cmds->processStatus), 0, &cmds->processUsage);
+        cmds->timedOut = false;
+        return;
+    }
+    struct pollfd fds[2] = {
+        { .fd = sigchld_pipe[0], .events = POLLIN },
+        { .fd = cmds->timer_fd, .events = POLLIN }
+    };
+    drain_sigchld_pipe();
+    while (wait4(pid, &(cmds->processStatus), WNOHANG, &cmds->processUsage) == 0) {
+        //EINTR (e.g. SIGTSTP) leaves revents empty, just poll again
+        if (poll(fds, 2, -1) == -1) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            drain_sigchld_pipe();
+        }
+        if (fds[1].revents & POLLIN) {
+            deadline_expire(cmds);
+        }
+    }
+    cmds->timedOut = deadline_remove(cmds, pid);
+}
+
+/*
+ * Function:  void wait_for_input(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Called before reading a command line while background deadlines are
+ * pending, so that they expire on time while the shell sits at the prompt.
+ * Only done for a terminal: a terminal hands out one line per read, whereas
+ * piped input may already be sitting in the stdin buffer.
+ */
+void wait_for_input(Commands* cmds) {
+    if (cmds->timer_fd == -1 || cmds->deadline_count == 0) {
+        return;
+    }
+    //Handle deadlines that passed while a command was running
+    deadline_expire(cmds);
+    if (!isatty(STDIN_FILENO)) {
+        return;
+    }
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = cmds->timer_fd, .events = POLLIN }
+    };
+    while (cmds->deadline_count > 0) {
+        if (poll(fds, 2, -1) == -1) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            deadline_expire(cmds);
+        }
+        if (fds[0].revents) {
+            break;
+        }
+    }
+}
+
+/*
+ * Function:  int proc_open(pid_t pid, const char* file)
+ * --------------------------------------------------------------------------
+ * Opens /proc/<pid>/<file>. Returns the descriptor, -1 on error.
+ */
+int proc_open(pid_t pid, const char* file) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Function:  ProcSample* proc_sample_lookup(Commands* cmds, pid_t pid)
+ * --------------------------------------------------------------------------
+ * Returns the sample of pid, opening /proc/<pid>/stat, statm and children on
+ * first use. The descriptors stay open between samples and are re-read with
+ * pread(). The cache uses at most half of the open file limit, so that many
+ * jobs cannot starve the shell of descriptors; processes beyond that are not
+ * cached and proc_read() opens their files for each read.
+ */
+ProcSample* proc_sample_lookup(Commands* cmds, pid_t pid) {
+    int cached = 0;
+    for (int i = 0; i < cmds->proc_sample_count; i++) {
+        if (cmds->proc_samples[i].pid == pid) {
+            return &cmds->proc_samples[i];
+        }
+        if (cmds->proc_samples[i].statFd != -1) {
+            cached++;
+        }
+    }
+    cmds->proc_samples = grow_array(cmds->proc_samples, cmds->proc_sample_count,
+        &cmds->proc_sample_capacity, sizeof(ProcSample));
+    ProcSample* sample = &cmds->proc_samples[cmds->proc_sample_count++];
+    memset(sample, 0, sizeof(ProcSample));
+    sample->pid = pid;
+    sample->statFd = -1;
+    sample->statmFd = -1;
+    sample->childrenFd = -1;
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY &&
+        (rlim_t)(cached + 1) * 3 > nofile.rlim_cur / 2) {
+        return sample;
+    }
+    char children[64];
+    snprintf(children, sizeof(children), "task/%d/children", pid);
+    sample->statFd = proc_open(pid, "stat");
+    sample->statmFd = proc_open(pid, "statm");
+    sample->childrenFd = proc_open(pid, children);
+    return sample;
+}
+
+/*
+ * Function:  void proc_sample_prune(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Closes the descriptors of processes that were not seen in the last sample.
+ */
+void proc_sample_prune(Commands* cmds) {
+    int kept = 0;
+    for (int i = 0; i < cmds->proc_sample_count; i++) {
+        ProcSample* sample = &cmds->proc_samples[i];
+        if (sample->seen) {
+            sample->seen = false;
+            cmds->proc_samples[kept++] = *sample;
+            continue;
+        }
+        if (sample->statFd != -1) {
+            close(sample->statFd);
+        }
+        if (sample->statmFd != -1) {
+            close(sample->statmFd);
+        }
+        if (sample->childrenFd != -1) {
+            close(sample->childrenFd);
+        }
+    }
+    cmds->proc_sample_count = kept;
+}
+
+/*
+ * Function:  int proc_read(pid_t pid, const char* file, int fd, char* buffer, int size)
+ * --------------------------------------------------------------------------
+ * Reads /proc/<pid>/<file> from the start and null terminates it, through
+ * the cached descriptor fd, or by opening the file if fd is -1.
+ * Returns the number of bytes read, -1 with errno set on error (ENOENT or
+ * ESRCH if the process is gone).
+ */
+int proc_read(pid_t pid, const char* file, int fd, char* buffer, int size) {
+    int length;
+    if (fd != -1) {
+        length = pread(fd, buffer, size - 1, 0);
+    }
+    else {
+        fd = proc_open(pid, file);
+        if (fd == -1) {
+            return -1;
+        }
+        length = read(fd, buffer, size - 1);
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    if (length < 0) {
+        return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+/*
+ * Function:  void format_kib(char* text, size_t size, unsigned long kib)
+ * --------------------------------------------------------------------------
+ * Formats a memory size given in KiB as K, M or G.
+ */
+void format_kib(char* text, size_t size, unsigned long kib) {
+    if (kib >= 1024 * 1024) {
+        snprintf(text, size, "%.1fG", kib / (1024.0 * 1024.0));
+    }
+    else if (kib >= 1024) {
+        snprintf(text, size, "%.1fM", kib / 1024.0);
+    }
+    else {
+        snprintf(text, size, "%luK", kib);
+    }
+}
+
+/*
+ * Function:  void jobstat_process(Commands* cmds, pid_t pid, int depth, const char* cmdline)
+ * --------------------------------------------------------------------------
+ * Samples one process and prints its line of the jobstat table, then does
+ * the same for each of its children.
+ *
+ * Columns:
+ *  CPU%: CPU time used since the previous sample, or since the process
+ *      started on its first sample
+ *  RSS: resident set size from /proc/<pid>/statm
+ *  S: process state (R running, S sleeping, D disk wait, Z zombie, ...)
+ *  ELAPSED: time since the process started
+ *
+ * Parameters:
+ *  pid_t pid: process to sample
+ *  int depth: 0 for a background job, 1.. for its descendants
+ *  const char* cmdline: command line of a background job, NULL for descendants
+ */
+void jobstat_process(Commands* cmds, pid_t pid, int depth, const char* cmdline) {
+    char buffer[MAX_CHARS_INPUT];
+    char children[64];
+    ProcSample* sample = proc_sample_lookup(cmds, pid);
+    //Stop at processes that are already listed, and at runaway depths
+    if (sample->seen || depth > 32) {
+        return;
+    }
+    sample->seen = true;
+    if (proc_read(pid, "stat", sample->statFd, buffer, sizeof(buffer)) <= 0) {
+        //Process is gone, skip it, otherwise still list the job
+        if (errno != ENOENT && errno != ESRCH) {
+            printf("%7d %*s  jobstat: cannot read /proc/%d/stat: %s\n", pid, depth * 2, "", pid, strerror(errno));
+        }
+        return;
+    }
+
+    //Command name is in parentheses and may contain spaces, fields follow the last ')'
+    char* nameStart = strchr(buffer, '(');
+    char* nameEnd = strrchr(buffer, ')');
+    if (nameStart == NULL || nameEnd == NULL) {
+        return;
+    }
+    *nameEnd = '\0';
+    char* name = nameStart + 1;
+    char state;
+    int ppid;
+    unsigned long utime, stime;
+    unsigned long long starttime;
+    //Fields 3 (state), 4 (ppid), 14 (utime), 15 (stime) and 22 (starttime) of proc(5)
+    if (sscanf(nameEnd + 2, "%c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %llu",
+        &state, &ppid, &utime, &stime, &starttime) != 5) {
+        return;
+    }
+
+    //Resident pages, second field of statm
+    char statm[128];
+    unsigned long residentPages = 0;
+    if (proc_read(pid, "statm", sample->statmFd, statm, sizeof(statm)) > 0) {
+        sscanf(statm, "%*u %lu", &residentPages);
+    }
+
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    double nowSeconds = now.tv_sec + now.tv_nsec / 1e9;
+    double elapsed = nowSeconds - (double)starttime / ticksPerSecond;
+    unsigned long long cpuTicks = utime + stime;
+    double cpuPercent;
+    if (sample->sampledAt > 0 && nowSeconds > sample->sampledAt) {
+        cpuPercent = 100.0 * (cpuTicks - sample->cpuTicks) / ticksPerSecond / (nowSeconds - sample->sampledAt);
+    }
+    else {
+        cpuPercent = (elapsed > 0) ? 100.0 * cpuTicks / ticksPerSecond / elapsed : 0;
+    }
+    sample->cpuTicks = cpuTicks;
+    sample->sampledAt = nowSeconds;
+
+    char rss[32];
+    format_kib(rss, sizeof(rss), residentPages * (sysconf(_SC_PAGESIZE) / 1024));
+    long seconds = (elapsed > 0) ? (long)elapsed : 0;
+    printf("%7d %7d %c %6.1f %8s %3ld:%02ld:%02ld  %*s%s\n", pid, ppid, state, cpuPercent, rss,
+        seconds / 3600, (seconds / 60) % 60, seconds % 60, depth * 2, "",
+        (cmdline != NULL) ? cmdline : name);
+
+    //Descendants: /proc/<pid>/task/<pid>/children lists the pids of the children
+    snprintf(children, sizeof(children), "task/%d/children", pid);
+    if (proc_read(pid, children, sample->childrenFd, buffer, sizeof(buffer)) > 0) {
+        char* saveptr;
+        for (char* child = strtok_r(buffer, " \n", &saveptr); child != NULL; child = strtok_r(NULL, " \n", &saveptr)) {
+            jobstat_process(cmds, atoi(child), depth + 1, NULL);
+        }
+    }
+}
+
+/*
+ * Function:  int jobstat_sample(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Prints one jobstat table covering every background process that has not
+ * been reaped yet and its descendants. Returns the number of background jobs.
+ */
+int jobstat_sample(Commands* cmds) {
+    int jobs = 0;
+    printf("%7s %7s %c %6s %8s %9s  %s\n", "PID", "PPID", 'S', "CPU%", "RSS", "ELAPSED", "COMMAND");
+    for (int i = 0; i < cmds->bg_procs_count; i++) {
+        //Command line is freed when the process is reaped
+        if (cmds->bg_cmdlines[i] != NULL) {
+            jobstat_process(cmds, cmds->background_processes[i], 0, cmds->bg_cmdlines[i]);
+            jobs++;
+        }
+    }
+    fflush(stdout);
+    proc_sample_prune(cmds);
+    return jobs;
+}
+
+void reap_background_processes(Commands* cmds);
+
+/*
+ * Function:  void jobstat_command(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Built-in "jobstat" command, shows CPU, memory, state and elapsed time of
+ * the background jobs and their descendants.
+ *  jobstat                    print one table
+ *  jobstat -w [SECONDS]       refresh every SECONDS (default 2) until Enter
+ *  jobstat -n COUNT           stop after COUNT tables (with -w)
+ * Deadlines keep being enforced while the table is refreshing, and finished
+ * jobs are reaped after each table so that they drop out of the next one.
+ *
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS], int numArgs: tokenized command
+ *  pid_t background_processes[MAX_ARGS], char* bg_cmdlines[MAX_ARGS]: background jobs
+ */
+void jobstat_command(Commands* cmds) {
+    bool watch = false;
+    long interval_ms = 2000;
+    int count = 0;
+    for (int i = 1; i < cmds->numArgs; i++) {
+        if (strcmp(cmds->inputArgs[i], "-w") == 0) {
+            watch = true;
+            if (i + 1 < cmds->numArgs && parse_duration(cmds->inputArgs[i + 1], &interval_ms)) {
+                i++;
+            }
+        }
+        else if (strcmp(cmds->inputArgs[i], "-n") == 0 && i + 1 < cmds->numArgs) {
+            char* end;
+            count = strtol(cmds->inputArgs[++i], &end, 10);
+            if (*end != '\0' || count <= 0) {
+                count = -1;
+                break;
+            }
+        }
+        else {
+            count = -1;
+            break;
+        }
+    }
+    //Bad option or value, or -n without -w
+    if (count < 0 || (count > 0 && !watch)) {
+        fprintf(stderr, "usage: jobstat [-w [SECONDS]] [-n COUNT]\n");
+        fflush(stdout);
+        return;
+    }
+
+    bool clearScreen = watch && isatty(STDOUT_FILENO);
+    bool watchInput = isatty(STDIN_FILENO);
+    struct pollfd fds[2] = {
+        { .fd = watchInput ? STDIN_FILENO : -1, .events = POLLIN },
+        { .fd = cmds->timer_fd, .events = POLLIN }
+    };
+    for (int samples = 1; ; samples++) {
+        if (clearScreen) {
+            printf("\033[H\033[2J");
+        }
+        if (jobstat_sample(cmds) == 0 || !watch || samples == count) {
+            break;
+        }
+        //Jobs that finished are not listed (as zombies) again
+        reap_background_processes(cmds);
+        //Sleep until the next refresh, a deadline or Enter
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long remaining;
+        while ((remaining = interval_ms - elapsed_ms(&start)) > 0) {
+            if (poll(fds, 2, remaining) <= 0) {
+                continue;
+            }
+            if (fds[1].revents & POLLIN) {
+                deadline_expire(cmds);
+            }
+            if (fds[0].revents) {
+                //Consume the line that stopped the refresh
+                char line[MAX_CHARS_INPUT];
+                read(STDIN_FILENO, line, sizeof(line));
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Function:  void expand_variable(char* inputBuffer, int buffLen)
+ * --------------------------------------------------------------------------
+ * Called by the function void get_user_input.Takes parameter char* inputBuffer 
+ * and replaces pairs of $$ values with the process pid. 
+ * Substring comparison is done via char *strstr(const char *main_string, const char *substring).
+ * int sprintf(char *str, const char *format, ...) is used for reformatting
+ * the string to have pid replace %d.
+ *
+ * Parameters:
+ *  char* inputBuffer: user inputed arguments (untokenized)
+ *  int buffLen: Length of the inputBuffer
+ *
+ */
+
+void expand_variable(char* inputBuffer, int buffLen) {
+    //Temporary string buffer used to save inputBuffer char values
+    //and expand $$ values
+    char string[buffLen + 1];
+    strcpy(string, inputBuffer);
+    //Substring to match
+    char substr[] = "$$";
+    //Char value used to replace substring $$ values
+    char* replace_1 = "%";
+    int substr_size = strlen(substr);
+    //Make a copy of your `string` pointer (for safety)
+    char* ptr = string;
+
+    //Loop through string and replace $$ with pid
+    while (1) {
+        //Find pointer to next substring
+        ptr = strstr(ptr, substr);
+        //If no substring found, then break from the loop
+        if (ptr == NULL) {
+            break;
+        }
+        //If found, then replace it with "%"
+        memset(ptr, *replace_1, substr_size);
+
+        //Replace second character after % with a d to get %d
+        *(ptr + 1) = 'd';
+        //Increment our string pointer, pass replaced substring
+        ptr += substr_size;
+    }
+    //Format string %d and replace it with pid
+    sprintf(inputBuffer, string, getpid());
+    //Reset pointers
+    ptr = NULL;
+    replace_1 = NULL;
+}
+
+/*
+ * Function:  bool read_input_line(Commands* cmds, const char* prompt, char* buffer)
+ * --------------------------------------------------------------------------
+ * Prints prompt and reads one line of user input (at most MAX_CHARS_INPUT
+ * characters) into buffer without its newline. Background deadlines are
+ * still enforced while waiting. Returns false at end of input.
+ */
+bool read_input_line(Commands* cmds, const char* prompt, char* buffer) {
+    //Reset buffer before saving user input
+    memset(buffer, '\0', MAX_CHARS_INPUT);
+    fflush(stdout);
+    fflush(stdin);
+    //Output command line prompt
+    write(STDOUT_FILENO, prompt, strlen(prompt));
+    //clear stdout
+    fflush(stdout);
+
+    //Keep enforcing background deadlines while waiting for input
+    wait_for_input(cmds);
+
+    //Read user input and save into buffer
+    if (fgets(buffer, MAX_CHARS_INPUT, stdin) == NULL) {
+        return false;
+    }
+    //Delete newline character at the end of user input
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return true;
+}
+
+/*
+ * Function:  bool starts_loop(const char* line)
+ * --------------------------------------------------------------------------
+ * Returns true if the command line starts with a "for" or "while" loop.
+ */
+bool starts_loop(const char* line) {
+    line += strspn(line, " \t");
+    return strncmp(line, "for ", 4) == 0 || strncmp(line, "while ", 6) == 0;
+}
+
+/*
+ * Function:  int tokenize_loop(char* text, char*** tokens, int* capacity)
+ * --------------------------------------------------------------------------
+ * Splits the text of a loop in place into words. Words are separated by
+ * spaces, and ";" is always a token of its own, even when attached to a
+ * word ("c;" gives "c" and ";"). Returns the number of tokens.
+ */
+int tokenize_loop(char* text, char*** tokens, int* capacity) {
+    int count = 0;
+    char* p = text;
+    while (*p != '\0') {
+        if (*p == ' ' || *p == '\t') {
+            *p++ = '\0';
+            continue;
+        }
+        *tokens = grow_array(*tokens, count, capacity, sizeof(char*));
+        if (*p == ';') {
+            *p++ = '\0';
+            (*tokens)[count++] = ";";
+            continue;
+        }
+        (*tokens)[count++] = p;
+        p += strcspn(p, " \t;");
+    }
+    return count;
+}
+
+/*
+ * Function:  void node_add_word(ShellNode* node, char* word)
+ * --------------------------------------------------------------------------
+ * Appends a word to a command or to the word list of a for loop, and notes
+ * whether it contains "$" so that only those words are substituted when
+ * the loop runs.
+ */
+void node_add_word(ShellNode* node, char* word) {
+    int expandCapacity = node->wordCapacity;
+    node->words = grow_array(node->words, node->wordCount, &node->wordCapacity, sizeof(char*));
+    node->expand = grow_array(node->expand, node->wordCount, &expandCapacity, sizeof(bool));
+    node->words[node->wordCount] = word;
+    node->expand[node->wordCount] = strchr(word, '$') != NULL;
+    node->wordCount++;
+}
+
+/*
+ * Function:  void free_node_list(NodeList* list)
+ * --------------------------------------------------------------------------
+ * Frees a parsed loop. The words themselves belong to the loop text.
+ */
+void free_node_list(NodeList* list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->nodes[i].words);
+        free(list->nodes[i].expand);
+        free_node_list(&list->nodes[i].condition);
+        free_node_list(&list->nodes[i].body);
+    }
+    free(list->nodes);
+    memset(list, 0, sizeof(NodeList));
+}
+
+int parse_list(char** tokens, int count, int* pos, const char* terminator, NodeList* list, int depth);
+
+/*
+ * Function:  int parse_node(char** tokens, int count, int* pos, ShellNode* node, int depth)
+ * --------------------------------------------------------------------------
+ * Parses one command starting at tokens[*pos]:
+ *  for NAME in WORDS ; do LIST done
+ *  while LIST do LIST done
+ *  WORDS (a simple command, ended by ";" or "&")
+ * Returns PARSE_OK, PARSE_INCOMPLETE if the tokens end before the command
+ * does (more lines are needed), or PARSE_ERROR.
+ */
+int parse_node(char** tokens, int count, int* pos, ShellNode* node, int depth) {
+    if (depth >= MAX_LOOP_DEPTH) {
+        fprintf(stderr, "loops nested too deeply\n");
+        fflush(stdout);
+        return PARSE_ERROR;
+    }
+    if (strcmp(tokens[*pos], "for") == 0) {
+        node->type = NODE_FOR;
+        (*pos)++;
+        if (*pos + 1 >= count) {
+            return PARSE_INCOMPLETE;
+        }
+        node->name = tokens[(*pos)++];
+        if (strcmp(tokens[*pos], "in") != 0 || strspn(node->name, "abcdefghijklmnopqrstuvwxyz"
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") != strlen(node->name)) {
+            fprintf(stderr, "syntax error: expected for NAME in WORDS\n");
+            fflush(stdout);
+            return PARSE_ERROR;
+        }
+        (*pos)++;
+        //Word list ends at ";" (or at the end of the line)
+        while (*pos < count && strcmp(tokens[*pos], ";") != 0) {
+            node_add_word(node, tokens[(*pos)++]);
+        }
+        while (*pos < count && strcmp(tokens[*pos], ";") == 0) {
+            (*pos)++;
+        }
+        if (*pos == count) {
+            return PARSE_INCOMPLETE;
+        }
+        if (strcmp(tokens[*pos], "do") != 0) {
+            fprintf(stderr, "syntax error near unexpected token %s\n", tokens[*pos]);
+            fflush(stdout);
+            return PARSE_ERROR;
+        }
+        (*pos)++;
+        return parse_list(tokens, count, pos, "done", &node->body, depth + 1);
+    }
+    if (strcmp(tokens[*pos], "while") == 0) {
+        node->type = NODE_WHILE;
+        (*pos)++;
+        int result = parse_list(tokens, count, pos, "do", &node->condition, depth + 1);
+        if (result != PARSE_OK) {
+            return result;
+        }
+        return parse_list(tokens, count, pos, "done", &node->body, depth + 1);
+    }
+    //Simple command, "&" ends it like ";" but stays one of its words
+    node->type = NODE_COMMAND;
+    while (*pos < count && strcmp(tokens[*pos], ";") != 0) {
+        char* word = tokens[(*pos)++];
+        node_add_word(node, word);
+        if (strcmp(word, "&") == 0) {
+            break;
+        }
+    }
+    return PARSE_OK;
+}
+
+/*
+ * Function:  int parse_list(char** tokens, int count, int* pos, const char* terminator, NodeList* list, int depth)
+ * --------------------------------------------------------------------------
+ * Parses commands into list until the terminator keyword ("do" or "done")
+ * is found at the start of a command, or until the end of the tokens if
+ * terminator is NULL. A loop followed by "&" runs in the background.
+ * Returns PARSE_OK, PARSE_INCOMPLETE or PARSE_ERROR like parse_node.
+ */
+int parse_list(char** tokens, int count, int* pos, const char* terminator, NodeList* list, int depth) {
+    while (1) {
+        //Skip empty commands
+        while (*pos < count && strcmp(tokens[*pos], ";") == 0) {
+            (*pos)++;
+        }
+        if (*pos == count) {
+            return (terminator == NULL) ? PARSE_OK : PARSE_INCOMPLETE;
+        }
+        if (terminator != NULL && strcmp(tokens[*pos], terminator) == 0 && list->count > 0) {
+            (*pos)++;
+            return PARSE_OK;
+        }
+        if (strcmp(tokens[*pos], "do") == 0 || strcmp(tokens[*pos], "done") == 0) {
+            fprintf(stderr, "syntax error near unexpected token %s\n", tokens[*pos]);
+            fflush(stdout);
+            return PARSE_ERROR;
+        }
+        list->nodes = grow_array(list->nodes, list->count, &list->capacity, sizeof(ShellNode));
+        ShellNode* node = &list->nodes[list->count++];
+        memset(node, 0, sizeof(ShellNode));
+        int result = parse_node(tokens, count, pos, node, depth);
+        if (result != PARSE_OK) {
+            return result;
+        }
+        if (node->type != NODE_COMMAND && *pos < count && strcmp(tokens[*pos], "&") == 0) {
+            node->background = true;
+            (*pos)++;
+        }
+        //A loop ends its command, redirections of a whole loop are not supported
+        else if (node->type != NODE_COMMAND && *pos < count && strcmp(tokens[*pos], ";") != 0 &&
+            (terminator == NULL || strcmp(tokens[*pos], terminator) != 0)) {
+            fprintf(stderr, "syntax error near unexpected token %s\n", tokens[*pos]);
+            fflush(stdout);
+            return PARSE_ERROR;
+        }
+    }
+}
+
+/*
+ * Function:  int loop_nesting(const char* text, char*** tokens, int* capacity)
+ * --------------------------------------------------------------------------
+ * Returns the number of loops opened in text that are not closed yet:
+ * "for" / "while" starting a command minus "done" starting a command.
+ * Used to skip the rest of a loop that could not be read.
+ */
+int loop_nesting(const char* text, char*** tokens, int* capacity) {
+    char* scratch = strdup(text);
+    int count = tokenize_loop(scratch, tokens, capacity);
+    int depth = 0;
+    for (int i = 0; i < count; i++) {
+        bool commandStart = (i == 0 || strcmp((*tokens)[i - 1], ";") == 0 || strcmp((*tokens)[i - 1], "do") == 0);
+        if (commandStart && (strcmp((*tokens)[i], "for") == 0 || strcmp((*tokens)[i], "while") == 0)) {
+            depth++;
+        }
+        else if (commandStart && strcmp((*tokens)[i], "done") == 0) {
+            depth--;
+        }
+    }
+    free(scratch);
+    return depth;
+}
+
+/*
+ * Function:  void read_loop(Commands* cmds, const char* firstLine)
+ * --------------------------------------------------------------------------
+ * Called by get_user_input when a line starts with "for" or "while".
+ * Reads continuation lines (prompt "> ") until the loop is complete, then
+ * keeps the parsed loop in cmds->loop so that it can be run any number of
+ * times without reading, expanding or tokenizing its text again. The lines
+ * are joined with ";" into inputLine for the history, or with a space after
+ * "do", ";" or "&", which already end a command.
+ *
+ * Struct members utilized:
+ *  NodeList loop, char* loop_text: parsed loop and the text its words point into
+ *  char inputLine[MAX_CHARS_INPUT]: the loop on one line
+ */
+void read_loop(Commands* cmds, const char* firstLine) {
+    char* text = malloc(MAX_LOOP_CHARS);
+    char line[MAX_CHARS_INPUT];
+    char** tokens = NULL;
+    int tokenCapacity = 0;
+    snprintf(text, MAX_LOOP_CHARS, "%s", firstLine);
+
+    while (1) {
+        //Tokens point into a copy of the text, kept as loop_text if the loop is complete
+        char* scratch = strdup(text);
+        int count = tokenize_loop(scratch, &tokens, &tokenCapacity);
+        int pos = 0;
+        NodeList list = { 0 };
+        int result = parse_list(tokens, count, &pos, NULL, &list, 0);
+        if (result == PARSE_OK) {
+            cmds->loop = list;
+            cmds->loop_text = scratch;
+            break;
+        }
+        free_node_list(&list);
+        free(scratch);
+        if (result == PARSE_ERROR) {
+            break;
+        }
+        if (!read_input_line(cmds, "> ", line)) {
+            fprintf(stderr, "syntax error: unexpected end of file\n");
+            fflush(stdout);
+            break;
+        }
+        //A new line ends the previous command like ";" does
+        if (strlen(text) + strlen(line) + 2 >= MAX_LOOP_CHARS) {
+            fprintf(stderr, "loop is longer than %d characters\n", MAX_LOOP_CHARS - 1);
+            fflush(stdout);
+            //Read the rest of the loop without running it
+            int depth = loop_nesting(text, &tokens, &tokenCapacity) + loop_nesting(line, &tokens, &tokenCapacity);
+            while (depth > 0 && read_input_line(cmds, "> ", line)) {
+                depth += loop_nesting(line, &tokens, &tokenCapacity);
+            }
+            break;
+        }
+        //No ";" after a line ending in "do" (or already ending the command)
+        size_t length = strlen(text);
+        while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t')) {
+            length--;
+        }
+        bool endsCommand = (length > 0 && (text[length - 1] == ';' || text[length - 1] == '&')) ||
+            (length == 2 && strncmp(text, "do", 2) == 0) ||
+            (length > 2 && strncmp(text + length - 2, "do", 2) == 0 && strchr(" \t;", text[length - 3]) != NULL);
+        text[length] = '\0';
+        strcat(text, endsCommand ? " " : "; ");
+        strcat(text, line);
+    }
+    snprintf(cmds->inputLine, MAX_CHARS_INPUT, "%s", text);
+    free(tokens);
+    free(text);
+}
+
+/*
+ * Function:  void parse_command_options(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Processes the words of a tokenized command that are meant for the shell:
+ * "&" at the end (is_background_process), timeout / --deadline and limit.
+ * Used by get_user_input and for every command run inside a loop.
+ *
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS], int numArgs: tokenized command
+ *  int is_background_process: set to 1 for a background command
+ */
+void parse_command_options(Commands* cmds) {
+    //Set num as a temp variable to save values of numArgs
+    int num = cmds->numArgs;
+
+    // Check for & at the end of arguments
+    // If & is present and foreground only mode is not true,
+    // is_background_process value is set to 1 to indicate the process will be
+    // run in the background
+    if (num > 0 && strcmp(cmds->inputArgs[num - 1], "&") == 0) {
+        //make sure the array position is not null and the final 
+        free(cmds->inputArgs[num - 1]);
+        cmds->inputArgs[num - 1] = '\0';
+        //Decrement total number of arguments to account for the removal of "&"
+        cmds->numArgs = num - 1;
+        //Check if foreground only mode is active
+        if (foreground_only_mode == false) {
+            //Set background flag to run command in background
+            cmds->is_background_process = 1;
+        }
+        else {
+            //Set background flag to 0
+            //if foreground only mode is active
+            cmds->is_background_process = 0;
+        }
+    }
+    //Strip limit / timeout / --deadline options, limit may come before or after timeout
+    parse_limit_options(cmds);
+    parse_deadline_options(cmds);
+    parse_limit_options(cmds);
+}
+
+/*
+ * Function:  void get_user_input(Commands* cmds) 
+ * --------------------------------------------------------------------------
+ * void get_user_input takes user input into an initial inputBuffer and calls
+ * expand_variable if '$$' is present. Then, inputBuffer is tokenized into individual
+ * arguments and saved in Commands struct member inputArgs.
+ * Then, the function checks for & at the end of arguments to check if the command
+ * will be executed in the background or foreground.
+ * History events (!!, !n, !prefix) are expanded before anything else and the
+ * resulting line is saved in inputLine for the history.
+ * Finally "timeout DURATION" / "--deadline DURATION" are removed from the
+ * arguments by parse_deadline_options.
+ * A line starting with "for" or "while" is handed to read_loop instead, which
+ * reads the rest of the loop and parses it into cmds->loop.
+ * 
+ * Additional functionality:
+ *  1. If & is present and foreground only mode is not true,
+ *  is_background_process value is set to 1 to indicate the process will be 
+ *  run in the background. This is to process & early and remove the &
+ *  argument from the array of tokens. This simplifies executing commands 
+ *  without the need to worry about "&" still being in inputArgs array of
+ *  tokenized commands at the command execution stage in the "main" code block.
+ * 
+ * Parameters:
+ *  Commands* cmds: Pointer to Commands struct
+ * 
+ * Struct members utilized:
+ *  char* inputArgs[MAX_ARGS]: Stores tokenized command arguments
+ *  int numArgs: total number of tokenized arguments provided by user
+ *  char inputLine[MAX_CHARS_INPUT]: command line as entered
+ *  History history: used to expand history events
+ * 
+ */
+
+void get_user_input(Commands* cmds) {
+    //Used to store argument tokens
+    char* token;
+    //Input buffer to store initial user input via stdin
+    char inputBuffer[MAX_CHARS_INPUT];
+    //Command line prompt message 
+    char* prompt = ": ";
+    //Output command line prompt ": " and read user input into inputBuffer
+    //End of input works like "exit": history is saved and background processes are killed
+    if (!read_input_line(cmds, prompt, inputBuffer)) {
+        strcpy(inputBuffer, "exit");
+    }
+
+    //Expand !! / !n / !prefix history events
+    history_expand(&cmds->history, inputBuffer);
+    //Keep the command line as entered for the history
+    strcpy(cmds->inputLine, inputBuffer);
+
+    //for / while loops may span several lines: read and parse the whole loop
+    if (starts_loop(inputBuffer)) {
+        cmds->inputArgs[0] = NULL;
+        cmds->numArgs = 0;
+        read_loop(cmds, inputBuffer);
+        return;
+    }
+
+    //Set buffer length 
+    int bufferLength = strlen(inputBuffer);
+
+    // $$ Variable expansion
+    //Check for and expand $$ with shell's pid
+    if (strstr(inputBuffer, "$$") != NULL) {
+        //Call expand_variable to expand $$
+        expand_variable(inputBuffer, bufferLength);
+    }
+    //Reset number of arguments to 0
+    (cmds)->numArgs = 0;
+
+    //Input tokenization step:
+    //Tokenize inputBuffer delimited by spaces " "
+    int arg_count = 0;
+    //Begin tokenization
+    token = strtok(inputBuffer, " ");
+    //Blank line: leave inputArgs empty
+    cmds->inputArgs[arg_count] = NULL;
+    //For commands or flags following the initial command
+    if (token != NULL) {
+        while (token != NULL)
+        {
+            //Save next token to inputArgs array
+            cmds->inputArgs[arg_count] = strdup(token);
+            //Increment the total count of arguments provide
+            arg_count++;
+            token = strtok(NULL, " \n");
+        }
+    }
+    //Set null pointer at the end of inputArgs array
+    cmds->inputArgs[arg_count + 1] = '\0';
+    //Save the total count of arguments
+    ((cmds)->numArgs) = arg_count;
+    //Free memory for token
+    free(token);
+    prompt = NULL;
+    //Reset token to NULL
+    token = NULL;
+
+    //Handle "&" and timeout / --deadline
+    parse_command_options(cmds);
+    memset(inputBuffer, '\0', MAX_ARGS);
+}
+
+
+/*
+ * Function:  handler_forward_SIGTERM
+ * --------------------------------------------------------------------------
+ * Installed in the fan-out process so that SIGTERM from the shell (exit,
+ * deadlines) reaches the command whose output is being copied.
+ */
+void handler_forward_SIGTERM(int signo) {
+    kill(fan_out_command_pid, SIGTERM);
+}
+
+/*
+ * Function:  void fan_out_move(int from, int to, size_t len)
+ * --------------------------------------------------------------------------
+ * Moves exactly len bytes out of the pipe from into the file to with
+ * splice(). If the target does not accept splice() (or fails), the bytes are
+ * copied through a buffer instead, so the pipe is always drained.
+ */
+void fan_out_move(int from, int to, size_t len) {
+    char buffer[FAN_OUT_BUFFER];
+    while (len > 0) {
+        ssize_t moved = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+        if (moved > 0) {
+            len -= moved;
+            continue;
+        }
+        ssize_t got = read(from, buffer, (len < sizeof(buffer)) ? len : sizeof(buffer));
+        if (got <= 0) {
+            return;
+        }
+        //Errors of a failing target are ignored, the other targets keep going
+        write(to, buffer, got);
+        len -= got;
+    }
+}
+
+/*
+ * Function:  void fan_out_copy(int source, int* targets, int count)
+ * --------------------------------------------------------------------------
+ * Copies everything written to the pipe source into every target until the
+ * writer closes the pipe. For each chunk, tee() duplicates the pipe contents
+ * into a scratch pipe without consuming them, and the scratch pipe is spliced
+ * into each target but the last; the last target then consumes the chunk from
+ * source. The data never passes through user space.
+ */
+void fan_out_copy(int source, int* targets, int count) {
+    int scratch[2];
+    if (pipe(scratch) == -1) {
+        perror("pipe");
+        return;
+    }
+    //Bigger pipes mean fewer tee/splice calls; the scratch pipe must hold a whole chunk
+    fcntl(source, F_SETPIPE_SZ, FAN_OUT_PIPE_SIZE);
+    fcntl(scratch[1], F_SETPIPE_SZ, fcntl(source, F_GETPIPE_SZ));
+    while (1) {
+        //Blocks until data is available, 0 once the command closed its stdout
+        ssize_t chunk = tee(source, scratch[1], FAN_OUT_PIPE_SIZE, 0);
+        if (chunk <= 0) {
+            break;
+        }
+        for (int i = 0; i < count - 1; i++) {
+            //The scratch pipe is empty again, duplicate the same chunk for the next target
+            if (i > 0) {
+                tee(source, scratch[1], chunk, 0);
+            }
+            fan_out_move(scratch[0], targets[i], chunk);
+        }
+        fan_out_move(source, targets[count - 1], chunk);
+    }
+    close(scratch[0]);
+    close(scratch[1]);
+}
+
+/*
+ * Function:  void fan_out_output(int* targets, int count)
+ * --------------------------------------------------------------------------
+ * Called by exec_other_commands in the child process when stdout is
+ * redirected to more than one file ("command > a > b").
+ * The child forks again: the new process returns and goes on to execvp the
+ * command with stdout connected to a pipe, while the child copies that pipe
+ * to every target with fan_out_copy. Once the output is copied the child
+ * exits with the command's exit status (or signal), so the shell still sees
+ * the command's status and only prompts once all files are complete.
+ * SIGTERM is passed on to the command; if the child is killed any other
+ * way (e.g. SIGKILL from a deadline) the command gets SIGKILL with it.
+ * The child is a copy of the shell, so it leaves with _exit(): exit() would
+ * flush the inherited stdin FILE and move the shell's input file offset.
+ *
+ * Parameters:
+ *  int* targets: open output files
+ *  int count: number of output files
+ */
+void fan_out_output(int* targets, int count) {
+    int data[2];
+    if (pipe(data) == -1) {
+        perror("pipe");
+        _exit(1);
+    }
+    pid_t fan_out_pid = getpid();
+    fan_out_command_pid = fork();
+    if (fan_out_command_pid == -1) {
+        perror("fork");
+        _exit(1);
+    }
+    //Process that executes the command: stdout is the pipe
+    if (fan_out_command_pid == 0) {
+        //Die with the fan-out process, it may have died before prctl()
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != fan_out_pid) {
+            _exit(1);
+        }
+        dup2(data[1], 1);
+        close(data[0]);
+        close(data[1]);
+        for (int i = 0; i < count; i++) {
+            close(targets[i]);
+        }
+        return;
+    }
+
+    //Fan-out process: pass SIGTERM on, then copy the command's output
+    struct sigaction SIGTERM_action = { 0 };
+    SIGTERM_action.sa_handler = &handler_forward_SIGTERM;
+    sigaction(SIGTERM, &SIGTERM_action, NULL);
+    signal(SIGCHLD, SIG_DFL);
+    close(data[1]);
+    fan_out_copy(data[0], targets, count);
+
+    //Report the command's status as our own
+    int status;
+    while (waitpid(fan_out_command_pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+        _exit(128 + WTERMSIG(status));
+    }
+    _exit(WEXITSTATUS(status));
+}
+
+/*
+ * Function:  void exec_other_commands(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Takes a pointer to Commands struct as a paraemter and runs non built-in commands.
+ * Handles redirect commands as well. Commands are excuted via
+ * execvp(cmds->inputArgs[0], cmds->inputArgs). Helps separate responsibilities 
+ * of built-in commands and non built-in commands.
+ * 
+ *  Overall structure:
  *   Function iterates over inputArgs array which contains tokenized arguments provided by the user.
  *   If there is file redirection, there is no need to check if it is a background command and
  *   file redirection is done via dup2 calls.
@@ -494,6 +2822,8 @@ void get_user_input(Commands* cmds) {
  *      2. If a process is a foreground process, 
  *           - input/output error if file not found 
  *           - Create file and write to file or open file and truncate file.
+ *      3. If ">" is given more than once, the output is written to every file
+ *         (see fan_out_output).
  *   
  * Parameters:
  *  Commands* cmds: Pointer to Commands struct
@@ -510,6 +2840,9 @@ void exec_other_commands(Commands* cmds) {
     int redirection_flag = 0;
     //file descriptor variable
     int fileDescriptor;
+    //Output files, every ">" adds one
+    int outputFiles[MAX_ARGS];
+    int outputCount = 0;
     //Iterator variable
     int i = 0;
     // --------------- Process executed in FOREGROUND -------------------------
@@ -544,14 +2877,14 @@ void exec_other_commands(Commands* cmds) {
             if (fileDescriptor == -1) {
                 //print an error message if there was an error
                 //opening the file.
-                fprintf(stderr, "cannot open %s for output\n", fileDescriptor);
+                fprintf(stderr, "cannot open %s for output\n", cmds->inputArgs[i + 1]);
                 fflush(stdout);
                 exit(1);
             }
             else { 
                 redirection_flag = 1;
-                //Redirect stdout to write to file
-                dup2(fileDescriptor, 1);
+                //Save the file, stdout is redirected once all ">" are known
+                outputFiles[outputCount++] = fileDescriptor;
             }
         }
         //If there is a redirection flag, set "<", ">", or file names to 0
@@ -561,6 +2894,15 @@ void exec_other_commands(Commands* cmds) {
             cmds->inputArgs[i] = 0;
         }         
     }
+    //Redirect stdout to write to the file
+    if (outputCount == 1) {
+        dup2(outputFiles[0], 1);
+        close(outputFiles[0]);
+    }
+    //Several output files: copy stdout to all of them
+    else if (outputCount > 1) {
+        fan_out_output(outputFiles, outputCount);
+    }
     // ------ Check if command is a background process and has no redirection -------
     // ---------- if no redirection provided, stdout/stdin uses /dev/null -----------
     if (redirection_flag == 0 && cmds->is_background_process == 1) {
@@ -591,6 +2933,8 @@ void exec_other_commands(Commands* cmds) {
     //execute the command, and print an error message
     //if the command was not found.
     fflush(stdout);
+    //Resource limits of this command, set last so they only apply to the command itself
+    apply_limits(&cmds->limits);
     int results = execvp(cmds->inputArgs[0], cmds->inputArgs);
     if (results) {
         //If file, directory, command not found
@@ -600,6 +2944,446 @@ void exec_other_commands(Commands* cmds) {
     }
 }
 
+/*
+ * Function:  void add_background_process(Commands* cmds, pid_t pid, const char* cmdline)
+ * --------------------------------------------------------------------------
+ * Saves a background process in background_processes together with its
+ * command line and start time. When the array is full, slots of processes
+ * that were already reaped are reused.
+ */
+void add_background_process(Commands* cmds, pid_t pid, const char* cmdline) {
+    if (cmds->bg_procs_count == MAX_ARGS) {
+        //Keep only processes that are still running (command line not freed yet)
+        int kept = 0;
+        for (int i = 0; i < cmds->bg_procs_count; i++) {
+            if (cmds->bg_cmdlines[i] != NULL) {
+                cmds->background_processes[kept] = cmds->background_processes[i];
+                cmds->bg_cmdlines[kept] = cmds->bg_cmdlines[i];
+                cmds->bg_start_times[kept] = cmds->bg_start_times[i];
+                cmds->bg_limits[kept] = cmds->bg_limits[i];
+                kept++;
+            }
+        }
+        cmds->bg_procs_count = kept;
+    }
+    if (cmds->bg_procs_count == MAX_ARGS) {
+        fprintf(stderr, "too many background processes, pid %d is not tracked\n", pid);
+        fflush(stdout);
+        return;
+    }
+    //add PID to background PID array for later
+    cmds->background_processes[cmds->bg_procs_count] = pid;
+    //keep the command line so it can be added to the history when it completes
+    cmds->bg_cmdlines[cmds->bg_procs_count] = strdup(cmdline);
+    clock_gettime(CLOCK_MONOTONIC, &cmds->bg_start_times[cmds->bg_procs_count]);
+    //keep the resource limits to report which one stopped the process
+    cmds->bg_limits[cmds->bg_procs_count] = cmds->limits;
+    //Increment count of background processes 
+    cmds->bg_procs_count++;
+}
+
+/*
+ * Function:  int execute_command(Commands* cmds, const char* cmdline)
+ * --------------------------------------------------------------------------
+ * Runs the tokenized command in inputArgs. If it matches a built-in command,
+ * the built-in command is executed. If there is no match, the command is run
+ * via a fork() child process and exec_other_commands().
+ * Used for command lines typed at the prompt and for every command run by a
+ * for / while loop.
+ *
+ * Parameters:
+ *  Commands* cmds: pointer to Commands struct
+ *  const char* cmdline: command line shown for a background process
+ *
+ * Returns:
+ *  the wait status of a foreground process, 0 for a built-in command,
+ *  EXEC_NOTHING for a blank or comment line, EXEC_BACKGROUND if a background
+ *  process was started and EXEC_FORK_FAILED if fork() failed.
+ */
+int execute_command(Commands* cmds, const char* cmdline) {
+    //Variable to store process id
+    int pid;
+
+    // --------------BUILT-IN COMMANDS--------------
+    // Check if inputed arguments have a "#" as the first argment
+    // Check if first argument is not NULL
+    if (cmds->inputArgs[0] == NULL || strncmp(cmds->inputArgs[0], "#", 1) == 0) {
+        //do nothing
+        return EXEC_NOTHING;
+    }
+    // Check user input for the "status" command
+    else if (strcmp(cmds->inputArgs[0], "status") == 0) {
+        //call check_status
+        check_status(cmds);
+        fflush(stdout);
+    }
+    //check user input for the "exit" command
+    else if (strcmp(cmds->inputArgs[0], "exit") == 0) {
+        //Set exitStatus flag to true
+        cmds->exitStatus = true;
+        history_add(&cmds->history, cmds->inputLine, 0, 0);
+        history_close(&cmds->history);
+        //Proceed to cleanup allocated memory for Commands struct
+        //and kill background processes
+        if (cmds->exitStatus) {
+            delete_commands(cmds);
+            //clean up any background processes exit the shell
+            kill_background_processes(cmds);
+        }
+        free(cmds);
+        //Exit program
+        exit(EXIT_SUCCESS);
+    }
+    //check user input for the "cd" command
+    else if (strcmp(cmds->inputArgs[0], "cd") == 0) {
+        cd_command(cmds);
+    }
+    //check user input for the "jobstat" command
+    else if (strcmp(cmds->inputArgs[0], "jobstat") == 0) {
+        jobstat_command(cmds);
+    }
+    //check user input for the "history" command
+    else if (strcmp(cmds->inputArgs[0], "history") == 0) {
+        history_command(cmds);
+    }
+    //check user input for the "ulimit" command
+    else if (strcmp(cmds->inputArgs[0], "ulimit") == 0) {
+        ulimit_command(cmds);
+    }
+    else {
+        //--------------Create child process ----------------------
+        // fork Child Process and execute custom command
+        // CHILD PROCESS
+        pid = fork();
+        //if there was an error forking the child process
+        if (pid < 0) {
+            //print an error message, clean up and exit
+            perror("Error!/n");
+            //Kill any background processes
+            kill_background_processes(cmds);
+            //Set process status
+            cmds->processStatus = 1;
+            return EXEC_FORK_FAILED;
+        }
+        //instructions for the child process
+        else if (pid == 0) {
+            //if this is a foreground process
+            if (cmds->is_background_process == 0 && !in_background_loop) {
+                // change to default signal handling
+                struct sigaction SIGINT_action = { 0 };
+                SIGINT_action.sa_handler = SIG_DFL;
+                SIGINT_action.sa_flags = 0;
+                sigaction(SIGINT, &SIGINT_action, NULL);
+            }
+            // EXECUTE Redirection and other commands via child process
+            exec_other_commands(cmds);
+        }
+        //--------For the parent process -------------
+        else {
+            //start the deadline timer if one was requested
+            if (cmds->deadline_ms > 0) {
+                deadline_add(cmds, pid);
+            }
+            //if this is a foreground process
+            if (cmds->is_background_process == 0) {
+                //wait for the process to complete				
+                wait_foreground(cmds, pid);
+                cmds->limitExceeded = limit_exceeded(&cmds->limits, cmds->processStatus, &cmds->processUsage);
+                //if process hit its deadline or a resource limit, say so
+                if (cmds->timedOut || cmds->limitExceeded != NULL) {
+                    check_status(cmds);
+                }
+                //if process was terminated, print an error 
+                //message with terminating signal
+                else if (WIFSIGNALED(cmds->processStatus)) {
+                    printf("terminated by signal %d\n", cmds->processStatus);
+                    fflush(stdout);
+                }
+                return cmds->processStatus;
+            }
+            // If this is a background process
+            //do not wait for the process to complete
+            if (wait4(pid, &(cmds->processStatus), WNOHANG, &cmds->processUsage) == pid) {
+                cmds->timedOut = false;
+                cmds->limitExceeded = NULL;
+                //Already reaped, its pid may be reused before the deadline passes
+                deadline_remove(cmds, pid);
+            }
+            add_background_process(cmds, pid, cmdline);
+            //print PID
+            printf("background pid is %d\n", pid);
+            fflush(stdout);
+            return EXEC_BACKGROUND;
+        }
+    }
+    //Built-in commands do not change the status
+    return 0;
+}
+
+/*
+ * Function:  void reap_background_processes(Commands* cmds)
+ * --------------------------------------------------------------------------
+ * Monitor any child background processes that have completed.
+ * WNOHANG, continue without waiting. Prints a message for every terminated
+ * background process and adds it to the history.
+ */
+void reap_background_processes(Commands* cmds) {
+    int pid = wait4(-1, &(cmds->processStatus), WNOHANG, &cmds->processUsage);
+    while (pid > 0) {
+        //processStatus now belongs to this process, drop the foreground process's deadline / limit flags
+        cmds->timedOut = false;
+        cmds->limitExceeded = NULL;
+        //Record the completed background command in the history
+        int bg_index = find_background_process(cmds, pid);
+        //Resource limit that stopped it, if any
+        const char* bg_limit = (bg_index != -1) ? limit_exceeded(&cmds->bg_limits[bg_index], cmds->processStatus, &cmds->processUsage) : NULL;
+        if (bg_index != -1 && cmds->bg_cmdlines[bg_index] != NULL) {
+            history_add(&cmds->history, cmds->bg_cmdlines[bg_index], cmds->processStatus,
+                elapsed_ms(&cmds->bg_start_times[bg_index]));
+            free(cmds->bg_cmdlines[bg_index]);
+            cmds->bg_cmdlines[bg_index] = NULL;
+        }
+        //Drop its deadline, and check if the deadline stopped it
+        bool bg_timed_out = deadline_remove(cmds, pid);
+        if (bg_timed_out) {
+            if (WIFEXITED(cmds->processStatus)) {
+                printf("background pid %d is done: timed out: exit value %d\n", pid, WEXITSTATUS(cmds->processStatus));
+            }
+            else {
+                printf("background pid %d is done: timed out: terminated by signal %d\n", pid, WTERMSIG(cmds->processStatus));
+            }
+            fflush(stdout);
+        }
+        else if (bg_limit != NULL) {
+            printf("background pid %d is done: terminated by signal %d: %s\n", pid, WTERMSIG(cmds->processStatus), bg_limit);
+            fflush(stdout);
+        }
+        //if process completes normally
+        //print the PID and exit value 
+        else if (WIFEXITED(cmds->processStatus) != 0 && pid > 0) {
+            printf("background pid %d is done: exit value %d\n", pid, cmds->processStatus);
+            fflush(stdout);
+        }
+        //If process was terminated, then output respective PID and signal number
+        else {
+            printf("background pid %d is done: terminated by signal %d\n", pid, cmds->processStatus);
+            fflush(stdout);
+        }
+        //Continue monitoring for any child process that terminates
+        pid = wait4(-1, &(cmds->processStatus), WNOHANG, &cmds->processUsage);
+    }
+}
+
+/*
+ * Function:  char* substitute_word(Commands* cmds, const char* word)
+ * --------------------------------------------------------------------------
+ * Returns a heap copy of a word of a loop with $NAME / ${NAME} replaced by
+ * the value of the loop variable NAME (innermost loop first) and $$
+ * replaced by the pid of the interactive shell, also when the loop runs in
+ * a background copy of the shell. Other "$" are kept as they are.
+ */
+char* substitute_word(Commands* cmds, const char* word) {
+    char result[MAX_CHARS_INPUT];
+    int length = 0;
+    const char* p = word;
+    while (*p != '\0' && length < MAX_CHARS_INPUT - 1) {
+        if (p[0] == '$' && p[1] == '$') {
+            length += snprintf(result + length, MAX_CHARS_INPUT - length, "%d", shell_pid);
+            p += 2;
+            continue;
+        }
+        if (p[0] == '$') {
+            bool braces = (p[1] == '{');
+            const char* name = p + 1 + braces;
+            int nameLength = 0;
+            while (isalnum((unsigned char)name[nameLength]) || name[nameLength] == '_') {
+                nameLength++;
+            }
+            int var = cmds->loop_depth - 1;
+            if (nameLength > 0 && (!braces || name[nameLength] == '}')) {
+                while (var >= 0 && (strncmp(cmds->loop_names[var], name, nameLength) != 0 ||
+                    cmds->loop_names[var][nameLength] != '\0')) {
+                    var--;
+                }
+            }
+            else {
+                var = -1;
+            }
+            if (var >= 0) {
+                length += snprintf(result + length, MAX_CHARS_INPUT - length, "%s", cmds->loop_values[var]);
+                p = name + nameLength + braces;
+                continue;
+            }
+        }
+        result[length++] = *p++;
+    }
+    if (length > MAX_CHARS_INPUT - 1) {
+        length = MAX_CHARS_INPUT - 1;
+    }
+    result[length] = '\0';
+    return strdup(result);
+}
+
+/*
+ * Function:  int run_command_node(Commands* cmds, ShellNode* node)
+ * --------------------------------------------------------------------------
+ * Runs a simple command of a loop. The parsed words are copied into
+ * inputArgs, substituting only the words that contain "$", and the command
+ * goes through the same option handling and execute_command() as a command
+ * typed at the prompt. Finished background processes are reaped after each
+ * command so that long loops do not pile up zombies.
+ */
+int run_command_node(Commands* cmds, ShellNode* node) {
+    char cmdline[MAX_CHARS_INPUT] = "";
+    int length = 0;
+    int count = 0;
+    for (int i = 0; i < node->wordCount && count < MAX_ARGS - 1; i++) {
+        char* word = node->expand[i] ? substitute_word(cmds, node->words[i]) : strdup(node->words[i]);
+        cmds->inputArgs[count++] = word;
+        //Command line shown for a background process
+        if (length < MAX_CHARS_INPUT - 1) {
+            length += snprintf(cmdline + length, MAX_CHARS_INPUT - length, "%s%s", (i > 0) ? " " : "", word);
+        }
+    }
+    cmds->inputArgs[count] = NULL;
+    cmds->numArgs = count;
+    cmds->is_background_process = 0;
+    cmds->deadline_ms = 0;
+    cmds->grace_ms = DEADLINE_GRACE_MS;
+    cmds->limits = cmds->default_limits;
+    parse_command_options(cmds);
+
+    int status = execute_command(cmds, cmdline);
+    reset_inputArgs(cmds);
+    reap_background_processes(cmds);
+    return status;
+}
+
+int run_node(Commands* cmds, ShellNode* node);
+
+/*
+ * Function:  int run_background_loop(Commands* cmds, ShellNode* node)
+ * --------------------------------------------------------------------------
+ * Runs a loop followed by "&" in a forked copy of the shell. Like other
+ * background processes its stdin and stdout are /dev/null. The copy gets
+ * its own SIGCHLD pipe, deadline timer and background process list, and
+ * does not write the history file.
+ */
+int run_background_loop(Commands* cmds, ShellNode* node) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Error!/n");
+        return EXEC_FORK_FAILED;
+    }
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_RDWR);
+        dup2(devNull, 0);
+        dup2(devNull, 1);
+        close(devNull);
+        in_background_loop = true;
+        //Do not share state with the interactive shell
+        if (cmds->history.fd != -1) {
+            close(cmds->history.fd);
+            cmds->history.fd = -1;
+        }
+        close(sigchld_pipe[0]);
+        close(sigchld_pipe[1]);
+        pipe2(sigchld_pipe, O_NONBLOCK | O_CLOEXEC);
+        close(cmds->timer_fd);
+        cmds->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        cmds->deadline_count = 0;
+        cmds->bg_procs_count = 0;
+        cmds->proc_sample_count = 0;
+        node->background = false;
+
+        int status = run_node(cmds, node);
+        if (status >= 0 && WIFSIGNALED(status)) {
+            exit(128 + WTERMSIG(status));
+        }
+        exit((status >= 0) ? WEXITSTATUS(status) : 0);
+    }
+    add_background_process(cmds, pid, cmds->inputLine);
+    printf("background pid is %d\n", pid);
+    fflush(stdout);
+    return EXEC_BACKGROUND;
+}
+
+/*
+ * Function:  bool loop_stopped(int status)
+ * --------------------------------------------------------------------------
+ * Returns true if a loop must stop after a command with this status:
+ * fork() failed, or the command was interrupted with ^C.
+ */
+bool loop_stopped(int status) {
+    return status == EXEC_FORK_FAILED || (status >= 0 && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT);
+}
+
+/*
+ * Function:  int run_list(Commands* cmds, NodeList* list)
+ * --------------------------------------------------------------------------
+ * Runs the commands of a parsed list in order, returns the last status.
+ */
+int run_list(Commands* cmds, NodeList* list) {
+    int status = 0;
+    for (int i = 0; i < list->count; i++) {
+        status = run_node(cmds, &list->nodes[i]);
+        if (loop_stopped(status)) {
+            break;
+        }
+    }
+    return status;
+}
+
+/*
+ * Function:  int run_node(Commands* cmds, ShellNode* node)
+ * --------------------------------------------------------------------------
+ * Runs one parsed command or loop.
+ *  for: runs the body once per word with the loop variable set to the word
+ *  while: runs the body as long as the last command of the condition
+ *      succeeds (exit value 0, or started in the background)
+ * Returns the status of the last command that ran.
+ */
+int run_node(Commands* cmds, ShellNode* node) {
+    int status = 0;
+    if (node->background && !foreground_only_mode) {
+        return run_background_loop(cmds, node);
+    }
+    if (node->type == NODE_COMMAND) {
+        return run_command_node(cmds, node);
+    }
+    if (node->type == NODE_FOR) {
+        cmds->loop_names[cmds->loop_depth] = node->name;
+        for (int i = 0; i < node->wordCount; i++) {
+            char* value = node->expand[i] ? substitute_word(cmds, node->words[i]) : node->words[i];
+            cmds->loop_values[cmds->loop_depth++] = value;
+            status = run_list(cmds, &node->body);
+            cmds->loop_depth--;
+            if (value != node->words[i]) {
+                free(value);
+            }
+            if (loop_stopped(status)) {
+                break;
+            }
+        }
+        return status;
+    }
+    //NODE_WHILE
+    while (1) {
+        int condition = run_list(cmds, &node->condition);
+        if (loop_stopped(condition)) {
+            return condition;
+        }
+        if (condition != 0 && condition != EXEC_BACKGROUND) {
+            break;
+        }
+        status = run_list(cmds, &node->body);
+        if (loop_stopped(status)) {
+            break;
+        }
+    }
+    return status;
+}
+
 /*Overall structure of main code block:
 *   Initialize signal handlers, Commands struct pointer, and Commands struct members.
 *   Proceeds to obtain user input and check tokenized arguments for matching
@@ -611,6 +3395,11 @@ void exec_other_commands(Commands* cmds) {
 *   create the overall structure of the while loop below.
 *
 *   Additional features and refactors:
+*       Built-in commands and the fork() of other commands now live in
+*       execute_command, so that for / while loops can run commands from their
+*       parsed form without going through get_user_input again. Reaping of
+*       background processes moved to reap_background_processes for the same reason.
+*
 *       While loop added at the end for parent process to monitor for
 *       any terminated child process. This was easier to implement than looping
 *       through the background_process array Command struct member and
@@ -626,9 +3415,6 @@ void exec_other_commands(Commands* cmds) {
 
 int main() {
 
-    //Variable to store process id
-    int pid;
-
     //custom handler for SIGTSTP, toggles foreground-only mode, prints text noteice, and raises signal flag
     struct sigaction SIGINT_action = { 0 };
     struct sigaction SIGTSTP_action = { 0 };
@@ -644,6 +3430,14 @@ int main() {
     SIGTSTP_action.sa_flags = SA_RESTART;
     sigaction(SIGTSTP, &SIGTSTP_action, NULL);
 
+    //signal handler to wake up poll() loops when a child exits
+    struct sigaction SIGCHLD_action = { 0 };
+    pipe2(sigchld_pipe, O_NONBLOCK | O_CLOEXEC);
+    SIGCHLD_action.sa_handler = &handler_SIGCHLD;
+    sigfillset(&SIGCHLD_action.sa_mask);
+    SIGCHLD_action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+
     //Commands struct Pointer
     Commands* ptrCMDS;
     //Allocate memory to point Commands struct
@@ -651,127 +3445,59 @@ int main() {
 
     //Initialize Commands struct members
     init_Commands_List(ptrCMDS);
+    shell_pid = getpid();
+    //Load persistent history and build its search index
+    history_load(&ptrCMDS->history);
+    //Start time of the current command, used for history durations
+    struct timespec startTime;
 
     while (1) {
         ((ptrCMDS)->numArgs) = 0;
         //reset struct member values
         ptrCMDS->is_background_process = 0;
+        ptrCMDS->deadline_ms = 0;
+        ptrCMDS->grace_ms = DEADLINE_GRACE_MS;
+        ptrCMDS->limits = ptrCMDS->default_limits;
         
         //GET USER INPUT
         get_user_input(ptrCMDS);
         fflush(stdout);
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
 
-        // ------------ After getting user input, check for BUILT-IN COMMANDS ------------------------------
-        // If it matches a built-in command, execute the built-in command
-        // If there is no match, execute other commands via fork() child process and exec_other_commands().
-        
-        // --------------BUILT-IN COMMANDS--------------
-        // Check if inputed arguments have a "#" as the first argment
-        // Check if first argument is not NULL
-        if (ptrCMDS->inputArgs[0] == NULL || strncmp(ptrCMDS->inputArgs[0], "#", 1) == 0) {
-            //do nothing
-        }
-        // Check user input for the "status" command
-        else if (strcmp(ptrCMDS->inputArgs[0], "status") == 0) {
-            //call check_status
-            //check_status(processStatus); --------------------------------------
-            check_status(ptrCMDS);
-            fflush(stdout);
+        // ------------ After getting user input, run the command or loop ------------------------------
+        // execute_command runs built-in commands itself and other commands via fork()
+        // and exec_other_commands(). A loop was already parsed by get_user_input and
+        // is run from its parsed form by run_list.
+        int status;
+        bool backgroundLoop = false;
+        bool ranLoop = ptrCMDS->loop.count > 0;
+        if (ranLoop) {
+            backgroundLoop = ptrCMDS->loop.nodes[ptrCMDS->loop.count - 1].background && !foreground_only_mode;
+            status = run_list(ptrCMDS, &ptrCMDS->loop);
+            free_node_list(&ptrCMDS->loop);
+            free(ptrCMDS->loop_text);
+            ptrCMDS->loop_text = NULL;
         }
-        //check user input for the "exit" command
-        else if (strcmp(ptrCMDS->inputArgs[0], "exit") == 0) {
-            //Set exitStatus flag to true
-            ptrCMDS->exitStatus = true;
-            //Proceed to cleanup allocated memory for Commands struct
-            //and kill background processes
-            if (ptrCMDS->exitStatus) {
-                delete_commands(ptrCMDS);
-                //clean up any background processes exit the shell
-                kill_background_processes(ptrCMDS);
-            }
-            free(ptrCMDS);
-            //Exit program
-            exit(EXIT_SUCCESS);
+        else {
+            status = execute_command(ptrCMDS, ptrCMDS->inputLine);
         }
-        //check user input for the "cd" command
-        else if (strcmp(ptrCMDS->inputArgs[0], "cd") == 0) {
-            cd_command(ptrCMDS);
+        //fork() failed, stop the shell
+        if (status == EXEC_FORK_FAILED) {
+            break;
         }
-        else {
-            //--------------Create child process ----------------------
-            // fork Child Process and execute custom command
-            // CHILD PROCESS
-            pid = fork();
-            //if there was an error forking the child process
-            if (pid < 0) {
-                //print an error message, clean up and exit
-                perror("Error!/n");
-                //Kill any background processes
-                kill_background_processes(ptrCMDS);
-                //Set process status
-                ptrCMDS->processStatus = 1;
-                break;
-            }
-            //instructions for the child process
-            else if (pid == 0) {
-                  //if this is a foreground process
-                if (ptrCMDS->is_background_process == 0) {
-                    // change to default signal handling
-                    SIGINT_action.sa_handler = SIG_DFL;
-                    SIGINT_action.sa_flags = 0;
-                    sigaction(SIGINT, &SIGINT_action, NULL);
-                }
-                // EXECUTE Redirection and other commands via child process
-                exec_other_commands(ptrCMDS);
-            }
-            //--------For the parent process -------------
-            else {
-                //if this is a foreground process
-                if (ptrCMDS->is_background_process == 0) {
-                    //wait for the process to complete				
-                    pid = waitpid(pid, &(ptrCMDS->processStatus), 0);
-                    //if process was terminated, print an error 
-                    //message with terminating signal
-                    if (WIFSIGNALED(ptrCMDS->processStatus)) {
-                        printf("terminated by signal %d\n", ptrCMDS->processStatus);
-                        fflush(stdout);
-                    }
-                }
-                // If this is a background process
-                if (ptrCMDS->is_background_process == 1) {
-                    //do not wait for the process to complete
-                    waitpid(pid, &(ptrCMDS->processStatus), WNOHANG);
-                    //add PID to background PID array for later
-                    ptrCMDS->background_processes[ptrCMDS->bg_procs_count] = pid;
-                    //print PID and increment background PID
-                    printf("background pid is %d\n", pid);
-                    fflush(stdout);
-                    //Increment count of background processes 
-                    ptrCMDS->bg_procs_count++;
-                }
-            }
+        //Record the command line in the history
+        //background commands are recorded when they complete
+        if (ranLoop && !backgroundLoop) {
+            history_add(&ptrCMDS->history, ptrCMDS->inputLine, (status >= 0) ? status : 0, elapsed_ms(&startTime));
+        }
+        else if (!ranLoop && status >= 0) {
+            history_add(&ptrCMDS->history, ptrCMDS->inputLine, status, elapsed_ms(&startTime));
         }
         //Reset inputArgs to 0
         reset_inputArgs(ptrCMDS);
         //Monitor any child background processes that have completed
         //WNOHANG, continue without waiting and proceed to the next loop
-        //Where parent process waits for any terminated child process.
-        pid = waitpid(-1, &(ptrCMDS->processStatus), WNOHANG);
-        while (pid > 0) {
-            //if process completes normally
-            //print the PID and exit value 
-            if (WIFEXITED(ptrCMDS->processStatus) != 0 && pid > 0) {
-                printf("background pid %d is done: exit value %d\n", pid, ptrCMDS->processStatus);
-                fflush(stdout);
-            }
-            //If process was terminated, then output respective PID and signal number
-            else {
-                printf("background pid %d is done: terminated by signal %d\n", pid, ptrCMDS->processStatus);
-                fflush(stdout);
-            }
-            //Continue monitoring for any child process that terminates
-            pid = waitpid(-1, &(ptrCMDS->processStatus), WNOHANG);
-        }
+        reap_background_processes(ptrCMDS);
     }
     return 0;
 }